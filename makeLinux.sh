@@ -1,20 +1,32 @@
 #!/bin/bash
 c++ -o backup -flto=auto -O3 -std=c++20 \
--lsqlite3 -lstdc++fs    \
+-lsqlite3 -lstdc++fs -lpthread \
+src/CBlake3.cpp         \
+src/CBloomFilter.cpp    \
 src/CCmdBackup.cpp      \
 src/CCmdClone.cpp       \
 src/CCmdDistill.cpp     \
 src/CCmdPurge.cpp       \
+src/CCmdUpgrade.cpp     \
 src/CCmdVerify.cpp      \
+src/CFileId.cpp         \
+src/CFileReader.cpp     \
 src/CFileTable.cpp      \
+src/CHash.cpp           \
+src/CHashAlgorithm.cpp  \
+src/CHasher.cpp         \
 src/CLogger.cpp         \
+src/CManifest.cpp       \
 src/COptions.cpp        \
 src/CPath.cpp           \
 src/CRepoFile.cpp       \
 src/CRepository.cpp     \
+src/CRepositoryIndex.cpp \
+src/CSha256.cpp         \
 src/CSize.cpp           \
 src/CSnapshot.cpp       \
 src/CSqliteWrapper.cpp  \
+src/CThreadPool.cpp     \
 src/CTime.cpp           \
 src/Helpers.cpp         \
 src/Main.cpp            \
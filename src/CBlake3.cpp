@@ -0,0 +1,515 @@
+#include "CBlake3.h"
+
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#   define BLAKE3_X86
+#   ifdef _MSC_VER
+#       define TARGET_AVX2
+#   else
+#       define TARGET_AVX2 __attribute__((target("avx2")))
+#   endif
+#   include <immintrin.h>
+#endif
+
+#include "CThreadPool.h"
+#include "Helpers.h"
+
+static constexpr uint32_t CHUNK_START   = 1 << 0;
+static constexpr uint32_t CHUNK_END     = 1 << 1;
+static constexpr uint32_t PARENT        = 1 << 2;
+static constexpr uint32_t ROOT          = 1 << 3;
+
+// smallest share of a subtree handed to one thread, smaller subtrees are hashed sequentially
+static constexpr size_t PARALLEL_MIN_CHUNKS = 64;
+
+static const uint32_t IV[8] =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+// message word order per round, the permutation applied repeatedly
+static const unsigned char MESSAGE_SCHEDULE[7][16] =
+{
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    {  2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8 },
+    {  3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1 },
+    { 10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6 },
+    { 12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4 },
+    {  9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7 },
+    { 11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13 },
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static inline uint32_t RotateRight(uint32_t value, int count)
+{
+    return (value >> count) | (value << (32 - count));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static inline void Mix(uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d, uint32_t x, uint32_t y)
+{
+    a = a + b + x;
+    d = RotateRight(d ^ a, 16);
+    c = c + d;
+    b = RotateRight(b ^ c, 12);
+    a = a + b + y;
+    d = RotateRight(d ^ a, 8);
+    c = c + d;
+    b = RotateRight(b ^ c, 7);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void LoadWords(const unsigned char* block, uint32_t* words)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        words[i] = uint32_t(block[4 * i]) | (uint32_t(block[4 * i + 1]) << 8)
+                 | (uint32_t(block[4 * i + 2]) << 16) | (uint32_t(block[4 * i + 3]) << 24);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void Compress(
+    const uint32_t* chainingValue,
+    const uint32_t* blockWords,
+    uint64_t        counter,
+    uint32_t        blockSize,
+    uint32_t        flags,
+    uint32_t*       output)
+{
+    uint32_t state[16] =
+    {
+        chainingValue[0], chainingValue[1], chainingValue[2], chainingValue[3],
+        chainingValue[4], chainingValue[5], chainingValue[6], chainingValue[7],
+        IV[0], IV[1], IV[2], IV[3],
+        static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), blockSize, flags,
+    };
+
+    for (int round = 0; round < 7; round++)
+    {
+        const unsigned char* schedule = MESSAGE_SCHEDULE[round];
+        Mix(state[0], state[4], state[8],  state[12], blockWords[schedule[0]],  blockWords[schedule[1]]);
+        Mix(state[1], state[5], state[9],  state[13], blockWords[schedule[2]],  blockWords[schedule[3]]);
+        Mix(state[2], state[6], state[10], state[14], blockWords[schedule[4]],  blockWords[schedule[5]]);
+        Mix(state[3], state[7], state[11], state[15], blockWords[schedule[6]],  blockWords[schedule[7]]);
+        Mix(state[0], state[5], state[10], state[15], blockWords[schedule[8]],  blockWords[schedule[9]]);
+        Mix(state[1], state[6], state[11], state[12], blockWords[schedule[10]], blockWords[schedule[11]]);
+        Mix(state[2], state[7], state[8],  state[13], blockWords[schedule[12]], blockWords[schedule[13]]);
+        Mix(state[3], state[4], state[9],  state[14], blockWords[schedule[14]], blockWords[schedule[15]]);
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        output[i]       = state[i] ^ state[i + 8];
+        output[i + 8]   = state[i + 8] ^ chainingValue[i];
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void CompressInPlace(uint32_t* chainingValue, const unsigned char* block, uint64_t counter, uint32_t blockSize, uint32_t flags)
+{
+    uint32_t words[16];
+    uint32_t output[16];
+    LoadWords(block, words);
+    Compress(chainingValue, words, counter, blockSize, flags, output);
+    std::memcpy(chainingValue, output, 8 * sizeof(uint32_t));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void ParentChainingValue(const uint32_t* left, const uint32_t* right, uint32_t* chainingValue)
+{
+    uint32_t words[16];
+    uint32_t output[16];
+    std::memcpy(words, left, 8 * sizeof(uint32_t));
+    std::memcpy(words + 8, right, 8 * sizeof(uint32_t));
+    Compress(IV, words, 0, CBlake3::BLOCK_SIZE, PARENT, output);
+    std::memcpy(chainingValue, output, 8 * sizeof(uint32_t));
+}
+
+#ifdef BLAKE3_X86
+static constexpr size_t AVX2_LANES = 8;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static bool UseAvx2()
+{
+    // selected once, based on the features of the executing cpu
+    static const bool sUseAvx2 = Helpers::CpuSupportsAvx2();
+    return sUseAvx2;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+template<int COUNT>
+TARGET_AVX2 static inline __m256i RotateRightAvx2(__m256i value)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(value, COUNT), _mm256_slli_epi32(value, 32 - COUNT));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+TARGET_AVX2 static inline void MixAvx2(__m256i& a, __m256i& b, __m256i& c, __m256i& d, __m256i x, __m256i y)
+{
+    // rotations by whole bytes are done with a byte shuffle
+    const __m256i rotate16 = _mm256_setr_epi8(
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13, 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rotate8 = _mm256_setr_epi8(
+        1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12, 1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+
+    a = _mm256_add_epi32(_mm256_add_epi32(a, b), x);
+    d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rotate16);
+    c = _mm256_add_epi32(c, d);
+    b = RotateRightAvx2<12>(_mm256_xor_si256(b, c));
+    a = _mm256_add_epi32(_mm256_add_epi32(a, b), y);
+    d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rotate8);
+    c = _mm256_add_epi32(c, d);
+    b = RotateRightAvx2<7>(_mm256_xor_si256(b, c));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+TARGET_AVX2 static void ChunkChainingValuesAvx2(const unsigned char* input, uint64_t chunkCounter, uint32_t* chainingValues)
+{
+    // eight consecutive chunks, one per lane
+    const __m256i chunkOffsets = _mm256_setr_epi32(0, 256, 512, 768, 1024, 1280, 1536, 1792);
+
+    alignas(32) uint32_t counterLow[AVX2_LANES];
+    alignas(32) uint32_t counterHigh[AVX2_LANES];
+    for (size_t lane = 0; lane < AVX2_LANES; lane++)
+    {
+        counterLow[lane]    = static_cast<uint32_t>(chunkCounter + lane);
+        counterHigh[lane]   = static_cast<uint32_t>((chunkCounter + lane) >> 32);
+    }
+
+    __m256i chainingValue[8];
+    for (int i = 0; i < 8; i++)
+    {
+        chainingValue[i] = _mm256_set1_epi32(static_cast<int>(IV[i]));
+    }
+
+    constexpr size_t blockCount = CBlake3::CHUNK_SIZE / CBlake3::BLOCK_SIZE;
+    for (size_t block = 0; block < blockCount; block++)
+    {
+        __m256i message[16];
+        for (int i = 0; i < 16; i++)
+        {
+            message[i] = _mm256_i32gather_epi32(reinterpret_cast<const int*>(input + block * CBlake3::BLOCK_SIZE + 4 * i), chunkOffsets, 4);
+        }
+
+        uint32_t flags = (block == 0 ? CHUNK_START : 0) | (block == blockCount - 1 ? CHUNK_END : 0);
+        __m256i state[16] =
+        {
+            chainingValue[0], chainingValue[1], chainingValue[2], chainingValue[3],
+            chainingValue[4], chainingValue[5], chainingValue[6], chainingValue[7],
+            _mm256_set1_epi32(static_cast<int>(IV[0])), _mm256_set1_epi32(static_cast<int>(IV[1])),
+            _mm256_set1_epi32(static_cast<int>(IV[2])), _mm256_set1_epi32(static_cast<int>(IV[3])),
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(counterLow)),
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(counterHigh)),
+            _mm256_set1_epi32(static_cast<int>(CBlake3::BLOCK_SIZE)),
+            _mm256_set1_epi32(static_cast<int>(flags)),
+        };
+
+        for (int round = 0; round < 7; round++)
+        {
+            const unsigned char* schedule = MESSAGE_SCHEDULE[round];
+            MixAvx2(state[0], state[4], state[8],  state[12], message[schedule[0]],  message[schedule[1]]);
+            MixAvx2(state[1], state[5], state[9],  state[13], message[schedule[2]],  message[schedule[3]]);
+            MixAvx2(state[2], state[6], state[10], state[14], message[schedule[4]],  message[schedule[5]]);
+            MixAvx2(state[3], state[7], state[11], state[15], message[schedule[6]],  message[schedule[7]]);
+            MixAvx2(state[0], state[5], state[10], state[15], message[schedule[8]],  message[schedule[9]]);
+            MixAvx2(state[1], state[6], state[11], state[12], message[schedule[10]], message[schedule[11]]);
+            MixAvx2(state[2], state[7], state[8],  state[13], message[schedule[12]], message[schedule[13]]);
+            MixAvx2(state[3], state[4], state[9],  state[14], message[schedule[14]], message[schedule[15]]);
+        }
+
+        for (int i = 0; i < 8; i++)
+        {
+            chainingValue[i] = _mm256_xor_si256(state[i], state[i + 8]);
+        }
+    }
+
+    alignas(32) uint32_t words[8][AVX2_LANES];
+    for (int i = 0; i < 8; i++)
+    {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(words[i]), chainingValue[i]);
+    }
+    for (size_t lane = 0; lane < AVX2_LANES; lane++)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            chainingValues[8 * lane + i] = words[i][lane];
+        }
+    }
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void SubtreeChainingValue(const unsigned char* input, uint64_t chunkCount, uint64_t chunkCounter, uint32_t* chainingValue)
+{
+    if (chunkCount == 1)
+    {
+        constexpr size_t blockCount = CBlake3::CHUNK_SIZE / CBlake3::BLOCK_SIZE;
+
+        std::memcpy(chainingValue, IV, sizeof(IV));
+        for (size_t i = 0; i < blockCount; i++)
+        {
+            uint32_t flags = (i == 0 ? CHUNK_START : 0) | (i == blockCount - 1 ? CHUNK_END : 0);
+            CompressInPlace(chainingValue, input + i * CBlake3::BLOCK_SIZE, chunkCounter, CBlake3::BLOCK_SIZE, flags);
+        }
+        return;
+    }
+
+#ifdef BLAKE3_X86
+    if (chunkCount == AVX2_LANES && UseAvx2())
+    {
+        uint32_t chainingValues[8 * AVX2_LANES];
+        ChunkChainingValuesAvx2(input, chunkCounter, chainingValues);
+        for (size_t count = AVX2_LANES; count > 1; count /= 2)
+        {
+            for (size_t i = 0; i < count / 2; i++)
+            {
+                ParentChainingValue(&chainingValues[16 * i], &chainingValues[16 * i + 8], &chainingValues[8 * i]);
+            }
+        }
+        std::memcpy(chainingValue, chainingValues, 8 * sizeof(uint32_t));
+        return;
+    }
+#endif
+
+    uint64_t halfCount = chunkCount / 2;
+    uint32_t left[8];
+    uint32_t right[8];
+    SubtreeChainingValue(input, halfCount, chunkCounter, left);
+    SubtreeChainingValue(input + halfCount * CBlake3::CHUNK_SIZE, halfCount, chunkCounter + halfCount, right);
+    ParentChainingValue(left, right, chainingValue);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void ParallelSubtreeChainingValue(const unsigned char* input, uint64_t chunkCount, uint64_t chunkCounter, uint32_t* chainingValue)
+{
+    CThreadPool& threadPool = CThreadPool::GetInstance();
+
+    // chunkCount is a power of two, so are the parts
+    uint64_t partCount = 1;
+    while (partCount < threadPool.GetThreadCount() && chunkCount / (2 * partCount) >= PARALLEL_MIN_CHUNKS)
+    {
+        partCount *= 2;
+    }
+    if (partCount == 1)
+    {
+        SubtreeChainingValue(input, chunkCount, chunkCounter, chainingValue);
+        return;
+    }
+
+    uint64_t partChunkCount = chunkCount / partCount;
+    std::vector<uint32_t> partChainingValues(8 * partCount);
+    threadPool.Run(partCount, [&](size_t part)
+    {
+        SubtreeChainingValue(
+            input + part * partChunkCount * CBlake3::CHUNK_SIZE,
+            partChunkCount,
+            chunkCounter + part * partChunkCount,
+            &partChainingValues[8 * part]);
+    });
+
+    for (; partCount > 1; partCount /= 2)
+    {
+        for (uint64_t i = 0; i < partCount / 2; i++)
+        {
+            ParentChainingValue(&partChainingValues[16 * i], &partChainingValues[16 * i + 8], &partChainingValues[8 * i]);
+        }
+    }
+    std::memcpy(chainingValue, partChainingValues.data(), 8 * sizeof(uint32_t));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CBlake3::StaticGetImplementationName()
+{
+#ifdef BLAKE3_X86
+    if (UseAvx2())
+    {
+        return "AVX2 x8";
+    }
+#endif
+    return "portable";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CBlake3::CBlake3()
+{
+    Reset();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CBlake3::Reset()
+{
+    std::memcpy(mChunkChainingValue, IV, sizeof(IV));
+    mChunkCounter       = 0;
+    mBlockSize          = 0;
+    mBlocksCompressed   = 0;
+    mStackSize          = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CBlake3::Update(const void* data, size_t size)
+{
+    const unsigned char* input = static_cast<const unsigned char*>(data);
+
+    while (size > 0)
+    {
+        // more input follows, so the completed chunk cannot be the root
+        if (mBlocksCompressed * BLOCK_SIZE + mBlockSize == CHUNK_SIZE)
+        {
+            FinishChunk();
+        }
+
+        // whole chunks starting at a chunk boundary are hashed as independent subtrees.
+        // at least one byte is kept back, as the last chunk might turn out to be the root
+        if (mBlocksCompressed == 0 && mBlockSize == 0 && size > CHUNK_SIZE)
+        {
+            uint64_t chunkCount = (size - 1) / CHUNK_SIZE;
+
+            // largest power of two that fits the input and is aligned to the chunk counter
+            int level = 0;
+            while ((uint64_t(2) << level) <= chunkCount && (mChunkCounter & ((uint64_t(2) << level) - 1)) == 0)
+            {
+                level++;
+            }
+            uint64_t subtreeChunkCount = uint64_t(1) << level;
+
+            uint32_t chainingValue[8];
+            ParallelSubtreeChainingValue(input, subtreeChunkCount, mChunkCounter, chainingValue);
+            mChunkCounter += subtreeChunkCount;
+            PushChainingValue(chainingValue, level);
+
+            input   += subtreeChunkCount * CHUNK_SIZE;
+            size    -= subtreeChunkCount * CHUNK_SIZE;
+            continue;
+        }
+
+        size_t fill = std::min(size, CHUNK_SIZE - mBlocksCompressed * BLOCK_SIZE - mBlockSize);
+        UpdateChunk(input, fill);
+        input   += fill;
+        size    -= fill;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CHash CBlake3::Finalize()
+{
+    // output node of the last chunk, then of all parents up to the root
+    uint32_t chainingValue[8];
+    uint32_t words[16];
+    uint64_t counter    = mChunkCounter;
+    uint32_t blockSize  = static_cast<uint32_t>(mBlockSize);
+    uint32_t flags      = CHUNK_END | (mBlocksCompressed == 0 ? CHUNK_START : 0);
+
+    std::memcpy(chainingValue, mChunkChainingValue, sizeof(chainingValue));
+    std::memset(mBlock + mBlockSize, 0, BLOCK_SIZE - mBlockSize);
+    LoadWords(mBlock, words);
+
+    for (size_t i = mStackSize; i > 0; i--)
+    {
+        uint32_t output[16];
+        Compress(chainingValue, words, counter, blockSize, flags, output);
+
+        std::memcpy(words, mStack[i - 1], 8 * sizeof(uint32_t));
+        std::memcpy(words + 8, output, 8 * sizeof(uint32_t));
+        std::memcpy(chainingValue, IV, sizeof(chainingValue));
+        counter     = 0;
+        blockSize   = BLOCK_SIZE;
+        flags       = PARENT;
+    }
+
+    uint32_t output[16];
+    Compress(chainingValue, words, 0, blockSize, flags | ROOT, output);
+
+    unsigned char bytes[DIGEST_SIZE];
+    for (size_t i = 0; i < DIGEST_SIZE; i++)
+    {
+        bytes[i] = static_cast<unsigned char>(output[i / 4] >> (8 * (i % 4)));
+    }
+    CHash result = bytes;
+
+    Reset();
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CBlake3::UpdateChunk(const unsigned char* data, size_t size)
+{
+    while (size > 0)
+    {
+        // a full block is compressed only when more input follows, the last one needs CHUNK_END
+        if (mBlockSize == BLOCK_SIZE)
+        {
+            CompressInPlace(mChunkChainingValue, mBlock, mChunkCounter, BLOCK_SIZE, mBlocksCompressed == 0 ? CHUNK_START : 0);
+            mBlocksCompressed++;
+            mBlockSize = 0;
+        }
+
+        size_t fill = std::min(size, BLOCK_SIZE - mBlockSize);
+        std::memcpy(mBlock + mBlockSize, data, fill);
+        mBlockSize  += fill;
+        data        += fill;
+        size        -= fill;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CBlake3::FinishChunk()
+{
+    uint32_t flags = CHUNK_END | (mBlocksCompressed == 0 ? CHUNK_START : 0);
+    CompressInPlace(mChunkChainingValue, mBlock, mChunkCounter, static_cast<uint32_t>(mBlockSize), flags);
+
+    uint32_t chainingValue[8];
+    std::memcpy(chainingValue, mChunkChainingValue, sizeof(chainingValue));
+    mChunkCounter++;
+    PushChainingValue(chainingValue, 0);
+
+    std::memcpy(mChunkChainingValue, IV, sizeof(IV));
+    mBlockSize          = 0;
+    mBlocksCompressed   = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CBlake3::PushChainingValue(uint32_t* chainingValue, int level)
+{
+    // the chunk counter already includes the new subtree. Each trailing zero bit above its level
+    // completes a subtree on the stack, which is merged right away
+    for (uint64_t count = mChunkCounter >> level; (count & 1) == 0; count >>= 1)
+    {
+        mStackSize--;
+        ParentChainingValue(mStack[mStackSize], chainingValue, chainingValue);
+    }
+
+    std::memcpy(mStack[mStackSize], chainingValue, 8 * sizeof(uint32_t));
+    mStackSize++;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "CHash.h"
+
+class CBlake3
+{
+public:
+    static constexpr size_t BLOCK_SIZE  = 64;
+    static constexpr size_t CHUNK_SIZE  = 1024;
+    static constexpr size_t DIGEST_SIZE = 32;
+
+public: // static
+    static std::string StaticGetImplementationName();
+
+public:
+    CBlake3();
+
+    void        Reset();
+    void        Update(const void* data, size_t size);
+    CHash       Finalize();
+
+private:
+    void UpdateChunk(const unsigned char* data, size_t size);
+    void FinishChunk();
+    void PushChainingValue(uint32_t* chainingValue, int level);
+
+    // chunk currently being filled
+    uint32_t        mChunkChainingValue[8];
+    uint64_t        mChunkCounter;
+    unsigned char   mBlock[BLOCK_SIZE];
+    size_t          mBlockSize;
+    size_t          mBlocksCompressed;
+
+    // chaining values of completed subtrees, one per set bit of the chunk counter
+    uint32_t        mStack[64][8];
+    size_t          mStackSize;
+};
@@ -0,0 +1,149 @@
+#include "CBloomFilter.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+#include "Helpers.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CBloomFilter::StaticLoad(const CPath& path, CBloomFilter& filter)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    char magic[sizeof(FILE_MAGIC)];
+    uint64_t wordCount = 0;
+    if (!file.read(magic, sizeof(magic))
+        || std::memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0
+        || !file.read(reinterpret_cast<char*>(&wordCount), sizeof(wordCount))
+        || wordCount == 0)
+    {
+        return false;
+    }
+
+    std::error_code errorCode;
+    auto fileSize = std::filesystem::file_size(path, errorCode);
+    if (errorCode || fileSize != sizeof(magic) + sizeof(wordCount) + wordCount * sizeof(uint64_t))
+    {
+        return false;
+    }
+
+    std::vector<uint64_t> words(wordCount);
+    if (!file.read(reinterpret_cast<char*>(words.data()), wordCount * sizeof(uint64_t)))
+    {
+        return false;
+    }
+
+    filter.mWords       = std::move(words);
+    filter.mBitCount    = wordCount * 64;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CBloomFilter::CBloomFilter(size_t keyCount)
+    :
+    mWords(std::max<size_t>(1, (keyCount * BITS_PER_KEY + 63) / 64)),
+    mBitCount(mWords.size() * 64)
+{}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CBloomFilter::Add(const std::string& key)
+{
+    uint64_t hash1;
+    uint64_t hash2;
+    StaticHash(key, hash1, hash2);
+
+    for (size_t i = 0; i < HASH_COUNT; i++)
+    {
+        uint64_t bit = (hash1 + i * hash2) % mBitCount;
+        mWords[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CBloomFilter::MayContain(const std::string& key) const
+{
+    if (mBitCount == 0)
+    {
+        return true;
+    }
+
+    uint64_t hash1;
+    uint64_t hash2;
+    StaticHash(key, hash1, hash2);
+
+    for (size_t i = 0; i < HASH_COUNT; i++)
+    {
+        uint64_t bit = (hash1 + i * hash2) % mBitCount;
+        if (!(mWords[bit / 64] & (uint64_t(1) << (bit % 64))))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CBloomFilter::Save(const CPath& path) const
+{
+    // written next to the target first, so a filter is either complete or missing
+    CPath tempPath = path;
+    tempPath += ".tmp";
+
+    // written in native byte order, a filter failing to load is ignored
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    uint64_t wordCount = mWords.size();
+    file.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+    file.write(reinterpret_cast<const char*>(&wordCount), sizeof(wordCount));
+    file.write(reinterpret_cast<const char*>(mWords.data()), wordCount * sizeof(uint64_t));
+    file.close();
+
+    std::error_code errorCode;
+    if (file.fail())
+    {
+        std::filesystem::remove(tempPath, errorCode);
+        return false;
+    }
+
+    Helpers::MakeWritable(path);
+    std::filesystem::rename(tempPath, path, errorCode);
+    if (errorCode)
+    {
+        std::filesystem::remove(tempPath, errorCode);
+        return false;
+    }
+
+    return Helpers::MakeReadOnly(path);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CBloomFilter::StaticHash(const std::string& key, uint64_t& hash1, uint64_t& hash2)
+{
+    // fnv-1a, spread by splitmix64 finalizers into two hashes for double hashing
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+
+    auto mix = [](uint64_t value)
+    {
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+        return value ^ (value >> 31);
+    };
+
+    hash1 = mix(hash);
+    hash2 = mix(hash1) | 1;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "CPath.h"
+
+// set membership with false positives but no false negatives, MayContain is a few memory probes
+class CBloomFilter
+{
+public:
+    static constexpr size_t BITS_PER_KEY    = 10;
+    static constexpr size_t HASH_COUNT      = 7;
+
+public: // static
+    // returns false if the file is missing or invalid
+    static bool StaticLoad(const CPath& path, CBloomFilter& filter);
+
+public:
+    CBloomFilter() = default;
+    CBloomFilter(CBloomFilter&&) = default;
+    CBloomFilter(const CBloomFilter&) = default;
+
+    // about 1% false positives with up to keyCount keys
+    CBloomFilter(size_t keyCount);
+
+    void Add(const std::string& key);
+    bool MayContain(const std::string& key) const;
+
+    bool Save(const CPath& path) const;
+
+    CBloomFilter& operator = (CBloomFilter&& other) = default;
+    CBloomFilter& operator = (const CBloomFilter& other) = default;
+
+private:
+    static void StaticHash(const std::string& key, uint64_t& hash1, uint64_t& hash2);
+
+    std::vector<uint64_t>   mWords;
+    uint64_t                mBitCount = 0;
+
+    inline static const char        FILE_MAGIC[8]       = { 'B', 'K', 'B', 'L', 'O', 'O', 'M', '1' };
+};
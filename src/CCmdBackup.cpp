@@ -4,6 +4,7 @@
 
 #include "COptions.h"
 #include "CLogger.h"
+#include "CHasher.h"
 #include "Helpers.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -17,7 +18,7 @@ std::string CCmdBackup::GetUsageSpec()
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 COptions CCmdBackup::GetOptionsSpec()
 {
-    return { { "help", "verbose", "incremental", "always_hash" }, { "suffix" } };
+    return { { "help", "verbose", "incremental", "always_hash", "ctime", "single_pass", "prefetch" }, { "suffix", "hash", "rehash", "memory_catalog" } };
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -44,9 +45,25 @@ void CCmdBackup::PrintHelp()
         "    backup file shares content with at least one other backup file.             \n"
         "    The search for an existing backup is a two-step process:                    \n"
         "    1. A file with same full path name, size, and modification time is searched.\n"
-        "    2. If no file was found, a SHA256 hash is calculated and searched.          \n"
+        "       Moved or renamed files are found by device and inode number instead of   \n"
+        "       the path name.                                                           \n"
+        "    2. If no file was found, a hash is calculated and searched.                 \n"
         "    Both searches are done using a file table in each snapshot in the form of a \n"
         "    sqlite database.                                                            \n"
+        "    The file tables of all finished snapshots are merged into a repository      \n"
+        "    index (.backup/index.sqlite in the repository), so each search is a single  \n"
+        "    query. The index is updated automatically when snapshots change.            \n"
+        "    Snapshots not in the index are searched one by one. Each finished snapshot  \n"
+        "    has a filter (.backup/filter.bin in the snapshot) ruling out most searches  \n"
+        "    without reading its file table.                                             \n"
+        "    Each finished snapshot also has a manifest (.backup/manifest.bin in the     \n"
+        "    snapshot), a sorted copy of its file table mapped into memory. It answers   \n"
+        "    searches of snapshots not in the index and complete reads of a snapshot,    \n"
+        "    e.g., by VERIFY and CLONE, without the database.                            \n"
+        "    Unchanged files are found in the newest snapshot, whose file table is read  \n"
+        "    in path order alongside the sources, which are traversed in the same order. \n"
+        "    Step 2 is skipped if no file of the same size exists in the repository.     \n"
+        "    Such a file is copied while its hash is calculated, reading it only once.   \n"
         "                                                                                \n"
         "    Hash calculation can be enforced by specifying --always_hash. This option   \n"
         "    may increase backup duration significantly, but might also reveal file      \n"
@@ -56,6 +73,16 @@ void CCmdBackup::PrintHelp()
         "    --always_hash is therefore usable only for revealing those files. They can  \n"
         "    be backuped after their modification time was changed.                      \n"
         "                                                                                \n"
+        "    Hashes are calculated with SHA256 or BLAKE3, see --hash. Each snapshot      \n"
+        "    records its algorithm, files are searched only in snapshots using the same  \n"
+        "    algorithm as the new snapshot.                                              \n"
+        "                                                                                \n"
+        "    Snapshots created by older versions of this tool keep the format of their   \n"
+        "    file table and are searched alongside newer ones. The UPGRADE command       \n"
+        "    rewrites their file tables in the current format, which is smaller and      \n"
+        "    faster to search, and adds the filter and manifest of snapshots finished    \n"
+        "    without them.                                                               \n"
+        "                                                                                \n"
         "    Files smaller than a file-system-dependent threshold are never hard-linked, \n"
         "    but added via a copy operation.                                             \n"
         "                                                                                \n"
@@ -127,6 +154,44 @@ void CCmdBackup::PrintHelp()
         "                    This option may increase backup duration significantly.     \n"
         "                    See also section \"Methods\".                               \n"
         "                                                                                \n"
+        "    --rehash=n      Rehashes a share of the files with known signature on each  \n"
+        "                    run, so that every file is rehashed once within n runs. The \n"
+        "                    share rotates with the number of snapshots in the           \n"
+        "                    repository. Like --always_hash, this reveals changes and    \n"
+        "                    corruption of sources, but spreads the cost over n runs.    \n"
+        "                                                                                \n"
+        "    --ctime         Extends the signature by inode number and status change time\n"
+        "                    (ctime) of the file. Unlike the modification time, both can \n"
+        "                    not be set back by user tools. Files changed without update \n"
+        "                    of their modification time are rehashed without the cost of \n"
+        "                    --always_hash. Snapshots not recording ctime are ignored for\n"
+        "                    signature search, their files are rehashed once.            \n"
+        "                                                                                \n"
+        "    --single_pass   Reads files of unknown signature only once: the file is     \n"
+        "                    copied into the snapshot while its hash is calculated. If   \n"
+        "                    the hash is found in the repository, the copy is replaced   \n"
+        "                    with a hard link afterwards. This option reduces reading    \n"
+        "                    from sources, but increases writing to the repository for   \n"
+        "                    files whose content is already backuped.                    \n"
+        "                                                                                \n"
+        "    --prefetch      Reads the repository index and the catalogs of the newest   \n"
+        "                    snapshots sequentially before starting. On disks with slow  \n"
+        "                    seeks, like spinning disks, this replaces many random reads \n"
+        "                    of the first lookups by a few sequential ones.              \n"
+        "                                                                                \n"
+        "    --memory_catalog=n                                                          \n"
+        "                    Builds the catalog of the new snapshot in memory and writes \n"
+        "                    it to the repository in one sequential pass when the backup \n"
+        "                    is finished, instead of many small random writes during the \n"
+        "                    backup. A catalog growing beyond n MiB is written to the    \n"
+        "                    repository at that point and continued there.               \n"
+        "                                                                                \n"
+        "    --hash=s        Selects the hash algorithm s of the new snapshot, either    \n"
+        "                    sha256 or blake3. Defaults to the algorithm of the newest   \n"
+        "                    snapshot, or sha256 for an empty repository. Snapshots of   \n"
+        "                    another algorithm are not used for deduplication. blake3    \n"
+        "                    hashes large files using all processor cores.               \n"
+        "                                                                                \n"
         "    --suffix=s      Adds the suffix s to the directory name of the new snapshot.\n"
         "                    This option can be used to mark spapshots, for example to   \n"
         "                    distinguish full snapshots from incremental ones.           \n"
@@ -158,25 +223,94 @@ bool CCmdBackup::Run(const std::vector<CPath>& paths, const COptions& options)
     CPath snapshotPath = repositoryPath / (CPath(Helpers::CurrentTimeAsString()) += suffix);
 
     CLogger::GetInstance().EnableDebugLog(mOptions.GetBool("verbose"));
+    LOG_DEBUG("hash implementations: " + CHasher::StaticGetImplementationNames(), COLOR_DEBUG);
 
     ReadConfig(configPath);
     PrepareSources(repositoryPath);
 
     mRepository.Open(repositoryPath, true);
+    if (mOptions.GetBool("prefetch"))
+    {
+        mRepository.Prefetch(PREFETCH_SNAPSHOT_COUNT);
+    }
+
+    // a repository keeps its hash algorithm unless another one is selected explicitly
+    CHashAlgorithm hashAlgorithm = CHashAlgorithm::SHA256;
+    if (!mOptions.GetString("hash").empty())
+    {
+        hashAlgorithm = CHashAlgorithm::StaticFromString(mOptions.GetString("hash"));
+    }
+    else if (!mRepository.GetAllSnapshots().empty())
+    {
+        hashAlgorithm = mRepository.GetAllSnapshots().back()->GetHashAlgorithm();
+    }
+
+    mRehashInterval = 0;
+    if (!mOptions.GetString("rehash").empty())
+    {
+        size_t parsedLength = 0;
+        try
+        {
+            mRehashInterval = std::stoll(mOptions.GetString("rehash"), &parsedLength);
+        }
+        catch (...)
+        {
+        }
+        if (mRehashInterval < 1 || parsedLength != mOptions.GetString("rehash").size())
+        {
+            throw "invalid number of runs for rehash: " + mOptions.GetString("rehash");
+        }
+    }
+
+    // the number of snapshots serves as run counter, selecting another share of files on each run
+    mRehashSlot = mRehashInterval > 0 ? static_cast<long long>(mRepository.GetAllSnapshots().size()) % mRehashInterval : 0;
 
     mTargetSnapshot = std::make_shared<CSnapshot>(snapshotPath, true);
+    mTargetSnapshot->SetHashAlgorithm(hashAlgorithm);
     mTargetSnapshot->SetInProgress();
+    if (!mOptions.GetString("memory_catalog").empty())
+    {
+        long long memoryLimit = 0;
+        size_t parsedLength = 0;
+        try
+        {
+            memoryLimit = std::stoll(mOptions.GetString("memory_catalog"), &parsedLength);
+        }
+        catch (...)
+        {
+        }
+        if (memoryLimit < 1 || parsedLength != mOptions.GetString("memory_catalog").size())
+        {
+            throw "invalid memory size for catalog: " + mOptions.GetString("memory_catalog");
+        }
+        mTargetSnapshot->BuildInMemory(memoryLimit * 1024 * 1024);
+    }
+    mTargetSnapshot->StartWriter();
     mRepository.AttachSnapshot(mTargetSnapshot);
 
     CLogger::GetInstance().Init(mTargetSnapshot->GetMetaDataPath());
     CLogger::GetInstance().Log("backing up to snapshot: " + mTargetSnapshot->GetAbsolutePath().string());
 
+    // most files are unchanged since the newest snapshot. Its catalog is streamed in source path
+    // order alongside the traversal, so they are found without searching the repository
+    for (auto it = mRepository.GetAllSnapshots().rbegin(); it != mRepository.GetAllSnapshots().rend(); it++)
+    {
+        if (*it != mTargetSnapshot && (*it)->GetHashAlgorithm() == hashAlgorithm)
+        {
+            LOG_DEBUG("parent snapshot: " + (*it)->GetAbsolutePath().string(), COLOR_DEBUG);
+            mParentCursor = std::make_unique<CSnapshot::CCursor>(**it);
+            break;
+        }
+    }
+
     for (auto& sourcePath : mSources)
     {
         LOG_DEBUG("processing source: " + sourcePath.string(), COLOR_DEBUG);
         BackupEntryRecursive(sourcePath, FormatTargetPath(sourcePath));
+        HashBatch();
     }
 
+    mParentCursor.reset();
     mTargetSnapshot->ClearInProgress();
 
     CLogger::GetInstance().Log("finished backing up to snapshot: " + mTargetSnapshot->GetAbsolutePath().string());
@@ -435,9 +569,24 @@ void CCmdBackup::BackupDirectory(const CPath& sourcePath, const CPath& targetPat
         return;
     }
 
+    // entries are visited in the byte-wise order of their full paths, the order of the catalogs.
+    // A directory is sorted by its name followed by a separator, as its contents are
+    std::vector<std::pair<std::string, CPath>> entries;
     for (auto& entry : std::filesystem::directory_iterator(sourcePath))
     {
-        BackupEntryRecursive(entry.path(), targetPathRelative / entry.path().filename());
+        std::string key = CSnapshot::PathToDBString(entry.path().filename());
+        std::error_code errorCode;
+        if (entry.is_directory(errorCode))
+        {
+            key += static_cast<char>(CPath::preferred_separator);
+        }
+        entries.emplace_back(std::move(key), entry.path());
+    }
+    std::sort(entries.begin(), entries.end());
+
+    for (auto& [key, entryPath] : entries)
+    {
+        BackupEntryRecursive(entryPath, targetPathRelative / entryPath.filename());
     }
 }
 
@@ -450,6 +599,7 @@ void CCmdBackup::BackupFile(const CPath& sourcePath, const CPath& targetPathRela
     targetFile.SetSourcePath(sourcePath);
     targetFile.SetRelativePath(targetPathRelative);
     targetFile.SetParentPath(mTargetSnapshot->GetAbsolutePath());
+    targetFile.SetHashAlgorithm(mTargetSnapshot->GetHashAlgorithm());
 
     if (!targetFile.ReadSourceProperties())
     {
@@ -457,38 +607,125 @@ void CCmdBackup::BackupFile(const CPath& sourcePath, const CPath& targetPathRela
         return;
     }
 
-    CRepoFile existingFile = mRepository.FindFile(
-        { targetFile.GetSourcePath(), targetFile.GetSize(), targetFile.GetTime(), {}, {}, {} },
-        false);
+    CRepoFile existingFile = FindExistingFile(targetFile);
 
-    if (existingFile.HasHash() && !mOptions.GetBool("always_hash"))
+    if (existingFile.HasHash() && !mOptions.GetBool("always_hash") && !IsRehashDue(existingFile))
     {
-        // assume file is unchanged, assume hash is identical
+        // assume file is unchanged, assume hash is identical.
+        // the hash is only proven for the ctime it was calculated with, keep that one
         LOG_DEBUG("skipping hashing: " + targetFile.SourceToString(), COLOR_SKIP);
         targetFile.SetHash(existingFile.GetHash());
+        targetFile.SetSourceChangeTime(existingFile.GetSourceChangeTime());
+        StoreFile(targetFile, existingFile, false);
+        return;
+    }
+
+    LOG_DEBUG("hashing: " + targetFile.SourceToString(), COLOR_HASH);
+    if (!LockSource(targetFile, existingFile))
+    {
+        return;
     }
-    else
+
+    // content of a size not found in the repository cannot be a duplicate, no need to hash it upfront
+    if (!existingFile.HasHash() && (mOptions.GetBool("single_pass") || !mRepository.IsSizeKnown(targetFile.GetSize())))
     {
-        LOG_DEBUG("hashing: " + targetFile.SourceToString(), COLOR_HASH);
-        if (!LockAndHash(targetFile, existingFile))
+        // signature is unknown, so the file is likely new. Copy it while hashing
+        if (!targetFile.CopyAndHashSource())
         {
+            CLogger::GetInstance().LogError("cannot import, excluding: " + targetFile.SourceToString());
             return;
         }
+        StoreFile(targetFile, existingFile, true);
+        return;
+    }
+
+    if (targetFile.GetSize() <= CRepoFile::HASH_BATCH_MAX_BYTES)
+    {
+        // small files are hashed together, the lock is held until the batch is stored
+        mHashBatch.push_back({ targetFile, existingFile });
+        if (mHashBatch.size() >= CRepoFile::HASH_BATCH_SIZE)
+        {
+            HashBatch();
+        }
+        return;
+    }
+
+    if (!targetFile.HashSource())
+    {
+        CLogger::GetInstance().LogError("cannot hash, excluding: " + targetFile.SourceToString());
+        return;
+    }
+
+    if (IsHashConsistent(targetFile, existingFile))
+    {
+        StoreFile(targetFile, existingFile, false);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CCmdBackup::HashBatch()
+{
+    std::vector<CRepoFile*> targetFiles;
+    for (auto& pendingFile : mHashBatch)
+    {
+        targetFiles.push_back(&pendingFile.mTargetFile);
+    }
+
+    CRepoFile::StaticHashSourceBatch(targetFiles);
+
+    for (auto& pendingFile : mHashBatch)
+    {
+        if (!pendingFile.mTargetFile.HasHash())
+        {
+            CLogger::GetInstance().LogError("cannot hash, excluding: " + pendingFile.mTargetFile.SourceToString());
+            continue;
+        }
+
+        if (IsHashConsistent(pendingFile.mTargetFile, pendingFile.mExistingFile))
+        {
+            StoreFile(pendingFile.mTargetFile, pendingFile.mExistingFile, false);
+        }
     }
 
+    mHashBatch.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CCmdBackup::StoreFile(CRepoFile& targetFile, CRepoFile& existingFile, bool imported)
+{
     if (existingFile.HasHash() && mOptions.GetBool("incremental"))
     {
         LOG_DEBUG("skipping linking: " + targetFile.SourceToString(), COLOR_SKIP);
         return;
     }
 
-    if (!existingFile.HasHash() || !existingFile.IsLinkable())
+    if ((!existingFile.HasHash() || !existingFile.IsLinkable()) && mRepository.IsSizeKnown(targetFile.GetSize()))
     {
         existingFile = mRepository.FindFile(
-            { {}, {}, {}, targetFile.GetHash(), {}, {} },
+            { {}, {}, {}, targetFile.GetHash(), {}, {}, targetFile.GetHashAlgorithm() },
             true);
     }
 
+    // later files of this size might be duplicates of this one
+    mRepository.AddKnownSize(targetFile.GetSize());
+
+    if (imported)
+    {
+        // the copy was written while hashing. Prefer a link in case the content is known
+        if (existingFile.HasHash() && existingFile.IsLinkable() && targetFile.ReplaceByLink(existingFile.GetFullPath()))
+        {
+            LOG_DEBUG("duplicated: " + targetFile.SourceToString(), COLOR_DUP);
+        }
+        else
+        {
+            CLogger::GetInstance().Log("importing: " + targetFile.SourceToString(), COLOR_IMPORT);
+        }
+        mTargetSnapshot->RegisterFile(targetFile);
+        return;
+    }
+
     if (existingFile.HasHash())
     {
         if (mTargetSnapshot->InsertFile(existingFile.GetFullPath(), targetFile, existingFile.IsLinkable()))
@@ -507,7 +744,7 @@ void CCmdBackup::BackupFile(const CPath& sourcePath, const CPath& targetPathRela
 
     CLogger::GetInstance().Log("importing: " + targetFile.SourceToString(), COLOR_IMPORT);
 
-    if (!mTargetSnapshot->InsertFile(sourcePath, targetFile, false))
+    if (!mTargetSnapshot->InsertFile(targetFile.GetSourcePath(), targetFile, false))
     {
         CLogger::GetInstance().LogError("cannot import, excluding: " + targetFile.SourceToString());
     }
@@ -515,7 +752,7 @@ void CCmdBackup::BackupFile(const CPath& sourcePath, const CPath& targetPathRela
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-bool CCmdBackup::LockAndHash(CRepoFile& targetFile, CRepoFile& existingFile)
+bool CCmdBackup::LockSource(CRepoFile& targetFile, CRepoFile& existingFile)
 {
     // lock file to prevent others from modification. The lock must be held until import is completed
     if (!targetFile.LockSource())
@@ -534,22 +771,97 @@ bool CCmdBackup::LockAndHash(CRepoFile& targetFile, CRepoFile& existingFile)
     }
 
     if (   targetFile.GetSize() != preLockTargetFile.GetSize()
-        || targetFile.GetTime() != preLockTargetFile.GetTime())
+        || targetFile.GetTime() != preLockTargetFile.GetTime()
+        || targetFile.GetSourceChangeTime() != preLockTargetFile.GetSourceChangeTime())
     {
         // file changed as we backup, repeat the search of an existing file.
-        // it is crucial to do a correct signature uniqueness check later in this method
-        existingFile = mRepository.FindFile(
-            { targetFile.GetSourcePath(), targetFile.GetSize(), targetFile.GetTime(), {}, {}, {} },
-            false);
+        // it is crucial to do a correct signature uniqueness check after hashing
+        existingFile = FindExistingFile(targetFile);
     }
 
-    if (!targetFile.HashSource())
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CRepoFile CCmdBackup::FindExistingFile(const CRepoFile& targetFile)
+{
+    CRepoFile constraints { targetFile.GetSourcePath(), targetFile.GetSize(), targetFile.GetTime(), {}, {}, {}, targetFile.GetHashAlgorithm() };
+
+    if (mOptions.GetBool("ctime"))
+    {
+        // without inode and ctime the file cannot be proven unchanged
+        if (!targetFile.GetSourceId().IsSpecified() || !targetFile.GetSourceChangeTime().IsSpecified())
+        {
+            return {};
+        }
+        constraints.SetSourceId(targetFile.GetSourceId());
+        constraints.SetSourceChangeTime(targetFile.GetSourceChangeTime());
+    }
+
+    if (mParentCursor)
+    {
+        for (auto& parentFile : mParentCursor->FindBySource(targetFile.GetSourcePath()))
+        {
+            if (   parentFile.GetSize() == constraints.GetSize()
+                && parentFile.GetTime() == constraints.GetTime()
+                && (!constraints.GetSourceId().IsSpecified() || parentFile.GetSourceId() == constraints.GetSourceId())
+                && (!constraints.GetSourceChangeTime().IsSpecified() || parentFile.GetSourceChangeTime() == constraints.GetSourceChangeTime()))
+            {
+                return parentFile;
+            }
+        }
+    }
+
+    CRepoFile existingFile = mRepository.FindFile(constraints, false);
+
+    if (!existingFile.HasHash() && targetFile.GetSourceId().IsSpecified())
+    {
+        // a moved or renamed file keeps its device, inode, size, and modification time
+        constraints.SetSourcePath({});
+        constraints.SetSourceId(targetFile.GetSourceId());
+        existingFile = mRepository.FindFile(constraints, false);
+        if (existingFile.HasHash())
+        {
+            LOG_DEBUG("moved: " + targetFile.SourceToString() + " from: " + existingFile.GetSourcePath().string(), COLOR_SKIP);
+        }
+    }
+
+    return existingFile;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CCmdBackup::IsRehashDue(const CRepoFile& existingFile)
+{
+    if (mRehashInterval == 0)
     {
-        CLogger::GetInstance().LogError("cannot hash, excluding: " + targetFile.SourceToString());
         return false;
     }
+
+    // hashes are uniformly distributed, so their prefix spreads files evenly over the runs
+    unsigned long long prefix = 0;
+    for (size_t i = 0; i < sizeof(prefix); i++)
+    {
+        prefix = prefix << 8 | existingFile.GetHash().GetBytes()[i];
+    }
+
+    return static_cast<long long>(prefix % static_cast<unsigned long long>(mRehashInterval)) == mRehashSlot;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CCmdBackup::IsHashConsistent(const CRepoFile& targetFile, CRepoFile& existingFile)
+{
     VERIFY(targetFile.HasHash());
 
+    if (existingFile.HasHash() && existingFile.GetHash() != targetFile.GetHash() && existingFile.GetSourcePath() != targetFile.GetSourcePath())
+    {
+        // found by source id only, which was reused for other content
+        existingFile = {};
+        return true;
+    }
+
     // signature required to be unique. Cannot import file if it is not.
     if (existingFile.HasHash() && existingFile.GetHash() != targetFile.GetHash())
     {
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 
 #include "CCmd.h"
 #include "CRepository.h"
@@ -25,16 +26,35 @@ private:
     void BackupEntryRecursive(const CPath& sourcePath, const CPath& targetPathRelative);
     void BackupDirectory(const CPath& sourcePath, const CPath& targetPathRelative);
     void BackupFile(const CPath& sourcePath, const CPath& targetPathRelative);
-    bool LockAndHash(CRepoFile& targetFile, CRepoFile& existingFile);
+    void HashBatch();
+    void StoreFile(CRepoFile& targetFile, CRepoFile& existingFile, bool imported);
+    bool LockSource(CRepoFile& targetFile, CRepoFile& existingFile);
+    CRepoFile FindExistingFile(const CRepoFile& targetFile);
+    bool IsRehashDue(const CRepoFile& existingFile);
+    bool IsHashConsistent(const CRepoFile& targetFile, CRepoFile& existingFile);
     void LogStats();
 
-    COptions                    mOptions;
-    std::vector<CPath>          mSources;
-    std::vector<CPath>          mExcludes;
-    CRepository                 mRepository;
-    std::shared_ptr<CSnapshot>  mTargetSnapshot;
+    class CPendingFile
+    {
+    public:
+        CRepoFile   mTargetFile;
+        CRepoFile   mExistingFile;
+    };
+
+    COptions                            mOptions;
+    std::vector<CPath>                  mSources;
+    std::vector<CPath>                  mExcludes;
+    CRepository                         mRepository;
+    std::shared_ptr<CSnapshot>          mTargetSnapshot;
+    std::vector<CPendingFile>           mHashBatch;
+    std::unique_ptr<CSnapshot::CCursor> mParentCursor;
+    long long                           mRehashInterval = 0;
+    long long                           mRehashSlot     = 0;
 
     long long mExcludeCountBlacklisted  = 0;
     long long mExcludeCountSymlink      = 0;
     long long mExcludeCountUnknownType  = 0;
+
+    // the newest one is the parent, older ones are searched for files moved or renamed since
+    inline static const size_t  PREFETCH_SNAPSHOT_COUNT = 4;
 };
@@ -84,16 +84,18 @@ bool CCmdClone::Run(const std::vector<CPath>& paths, const COptions& options)
 
         std::shared_ptr<CSnapshot> targetSnapshot = std::make_shared<CSnapshot>(targetSnapshotPath, true);
         targetSnapshot->SetInProgress();
+        targetSnapshot->SetHashAlgorithm(sourceSnapshot->GetHashAlgorithm());
+        targetSnapshot->StartWriter();
         targetRepository.AttachSnapshot(targetSnapshot);
 
         CLogger::GetInstance().Init(targetSnapshot->GetMetaDataPath());
         options.Log();
         CLogger::GetInstance().Log("cloning to snapshot: " + targetSnapshot->GetAbsolutePath().string());
 
-        std::vector<CRepoFile> sourceFiles = sourceSnapshot->FindAllFiles({});
-        for (auto& sourceFile : sourceFiles)
+        auto iterator = sourceSnapshot->IterateFiles({});
+        while (iterator.HasFile())
         {
-            CloneFile(sourceFile, targetRepository, *targetSnapshot, options);
+            CloneFile(iterator.ReadNextFile(), targetRepository, *targetSnapshot, options);
         }
 
         targetSnapshot->ClearInProgress();
@@ -123,11 +125,14 @@ void CCmdClone::CloneFile(const CRepoFile& sourceFile, CRepository& targetReposi
         sourceFile.GetTime(),
         sourceFile.GetHash(),
         sourceFile.GetRelativePath(),
-        targetSnapshot.GetAbsolutePath()
+        targetSnapshot.GetAbsolutePath(),
+        sourceFile.GetHashAlgorithm(),
+        sourceFile.GetSourceId(),
+        sourceFile.GetSourceChangeTime()
     };
 
     CRepoFile existingFile = targetRepository.FindFile(
-        { targetFile.GetSourcePath(), targetFile.GetSize(), targetFile.GetTime(), {}, {}, {} },
+        { targetFile.GetSourcePath(), targetFile.GetSize(), targetFile.GetTime(), {}, {}, {}, targetFile.GetHashAlgorithm() },
         false);
 
     if (existingFile.HasHash() && existingFile.GetHash() != targetFile.GetHash())
@@ -145,7 +150,7 @@ void CCmdClone::CloneFile(const CRepoFile& sourceFile, CRepository& targetReposi
     if (!existingFile.HasHash() || !existingFile.IsLinkable())
     {
         existingFile = targetRepository.FindFile(
-            { {}, {}, {}, targetFile.GetHash(), {}, {} },
+            { {}, {}, {}, targetFile.GetHash(), {}, {}, targetFile.GetHashAlgorithm() },
             true);
     }
 
@@ -88,22 +88,26 @@ bool CCmdDistill::Run(const std::vector<CPath>& paths, const COptions& options)
         options.Log();
         CLogger::GetInstance().Log("distilling snapshot: " + snapshot->GetAbsolutePath().string());
 
-        std::vector<CRepoFile> repoFiles = snapshot->FindAllFiles({});
-        for (auto& repoFile : repoFiles)
+        // deleting the current row is safe while iterating, the iterator ends before compacting
         {
-            CRepoFile existingFile = repository.FindFile(
-                { {}, {}, {}, repoFile.GetHash(), {}, {} },
-                false);
-                
-            if (!existingFile.HasHash())
+            auto iterator = snapshot->IterateFiles({});
+            while (iterator.HasFile())
             {
-                CLogger::GetInstance().Log("distilling: " + repoFile.ToString(), COLOR_DISTILL);
-                continue;
-            }
-            
-            if (!snapshot->DeleteFile(repoFile))
-            {
-                CLogger::GetInstance().LogError("cannot delete: " + repoFile.ToString());
+                CRepoFile& repoFile = iterator.ReadNextFile();
+                CRepoFile existingFile = repository.FindFile(
+                    { {}, {}, {}, repoFile.GetHash(), {}, {}, repoFile.GetHashAlgorithm() },
+                    false);
+
+                if (!existingFile.HasHash())
+                {
+                    CLogger::GetInstance().Log("distilling: " + repoFile.ToString(), COLOR_DISTILL);
+                    continue;
+                }
+
+                if (!snapshot->DeleteFile(repoFile))
+                {
+                    CLogger::GetInstance().LogError("cannot delete: " + repoFile.ToString());
+                }
             }
         }
 
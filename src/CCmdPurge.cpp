@@ -81,17 +81,20 @@ bool CCmdPurge::Run(const std::vector<CPath>& paths, const COptions& options)
         options.Log();
         CLogger::GetInstance().Log("purging snapshot: " + snapshot.GetAbsolutePath().string());
 
-        std::vector<CRepoFile> repoFiles = snapshot.FindAllFiles({});
-
-        for (auto& repoFile : repoFiles)
+        // deleting the current row is safe while iterating, the iterator ends before compacting
         {
-            if (!repoFile.IsExisting())
+            auto iterator = snapshot.IterateFiles({});
+            while (iterator.HasFile())
             {
-                CLogger::GetInstance().Log("purging: " + repoFile.ToString(), COLOR_PURGE);
-
-                snapshot.DBDelete(repoFile);
+                CRepoFile& repoFile = iterator.ReadNextFile();
+                if (!repoFile.IsExisting())
+                {
+                    CLogger::GetInstance().Log("purging: " + repoFile.ToString(), COLOR_PURGE);
+
+                    snapshot.DBDelete(repoFile);
+                }
+                LOG_DEBUG("skipping: " + repoFile.ToString(), COLOR_SKIP);
             }
-            LOG_DEBUG("skipping: " + repoFile.ToString(), COLOR_SKIP);
         }
 
         if (options.GetBool("compact_db"))
@@ -0,0 +1,118 @@
+#include "CCmdUpgrade.h"
+
+#include "COptions.h"
+#include "CLogger.h"
+#include "Helpers.h"
+#include "CThreadPool.h"
+#include "CRepository.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CCmdUpgrade::GetUsageSpec()
+{
+    return "<repository-dir> | <snapshot-dir> ...";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+COptions CCmdUpgrade::GetOptionsSpec()
+{
+    return { { "help", "verbose" }, {} };
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CCmdUpgrade::PrintHelp()
+{
+    CLogger::GetInstance().Log(
+        "                                                                                \n"
+        "UPGRADE                                                                         \n"
+        "                                                                                \n"
+        "Description:                                                                    \n"
+        "                                                                                \n"
+        "    Rewrites the databases of snapshots created by older versions of this tool  \n"
+        "    in the current database format and adds the filter and manifest of snapshots\n"
+        "    finished without them. Snapshots already up to date are skipped. Multiple   \n"
+        "    snapshots are upgraded concurrently.                                        \n"
+        "                                                                                \n"
+        "Application:                                                                    \n"
+        "                                                                                \n"
+        "    Snapshots of any database format can be used for backups, but older formats \n"
+        "    are larger and slower to search. Upgrading a repository once lets all of its\n"
+        "    history benefit from the current format. A copy of each old database is     \n"
+        "    kept in the .backup directory of its snapshot. An interrupted upgrade       \n"
+        "    leaves its snapshot unfinished. It is resumed by deleting the IN_PROGRESS   \n"
+        "    marker in its .backup directory and running UPGRADE again.                  \n"
+        "                                                                                \n"
+        "Path arguments:                                                                 \n"
+        "                                                                                \n"
+        "    <repository-dir> | <snapshot-dir> ...   Path to a repository or to snapshots\n"
+        "                                            to be upgraded.                     \n"
+        "                                                                                \n"
+        "Options:                                                                        \n"
+        "                                                                                \n"
+        "    --help          Displays this help text.                                    \n"
+        "                                                                                \n"
+        "    --verbose       Higher verbosity of command line logging.                   \n"
+    );
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CCmdUpgrade::Run(const std::vector<CPath>& paths, const COptions& options)
+{
+    if (options.GetBool("help"))
+    {
+        PrintHelp();
+        return true;
+    }
+
+    if (paths.empty())
+    {
+        return false;
+    }
+
+    CLogger::GetInstance().EnableDebugLog(options.GetBool("verbose"));
+    CLogger::GetInstance().Init("");
+    options.Log();
+
+    std::vector<CPath> snapshotPaths = paths;
+    if (snapshotPaths.size() == 1 && !CSnapshot::StaticIsExsting(snapshotPaths.back()))
+    {
+        snapshotPaths = CRepository::StaticGetSnapshotPaths(snapshotPaths.back());
+    }
+    else
+    {
+        CRepository::StaticValidateSnapshotPaths(snapshotPaths);
+    }
+
+    // versions are read here, open catalogs are tracked across snapshots and not by the pool
+    std::vector<CPath> upgradePaths;
+    for (auto& snapshotPath : snapshotPaths)
+    {
+        CSnapshot snapshot(snapshotPath, false);
+        if (!snapshot.IsUpgradeNeeded())
+        {
+            LOG_DEBUG("skipping: " + snapshot.GetAbsolutePath().string(), COLOR_SKIP);
+            continue;
+        }
+
+        CLogger::GetInstance().Log("upgrading snapshot: " + snapshot.GetAbsolutePath().string());
+        upgradePaths.push_back(snapshot.GetAbsolutePath());
+    }
+
+    // each task keeps its catalog writable, only writable catalogs are not shared with other snapshots
+    CThreadPool::GetInstance().Run(upgradePaths.size(), [&](size_t i)
+    {
+        CSnapshot snapshot(upgradePaths[i], false);
+        snapshot.SetInProgress();
+        snapshot.Upgrade();
+        snapshot.ClearInProgress();
+    });
+
+    CLogger::GetInstance().Log("finished upgrading " + std::to_string(upgradePaths.size()) + " of "
+        + std::to_string(snapshotPaths.size()) + " snapshots");
+    CLogger::GetInstance().Close();
+
+    return true;
+}
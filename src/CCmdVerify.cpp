@@ -2,6 +2,7 @@
 
 #include "COptions.h"
 #include "CLogger.h"
+#include "CHasher.h"
 #include "Helpers.h"
 #include "CRepository.h"
 
@@ -16,7 +17,7 @@ std::string CCmdVerify::GetUsageSpec()
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 COptions CCmdVerify::GetOptionsSpec()
 {
-    return { { "help", "verbose", "verify_hash", "write_file_table" }, {} };
+    return { { "help", "verbose", "verify_hash", "catalog_ids", "verify_ids", "write_file_table" }, {} };
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -50,6 +51,16 @@ void CCmdVerify::PrintHelp()
         "                        run time significantly. Files which are referenced from \n"
         "                        multiple hard links are checked only once.              \n"
         "                                                                                \n"
+        "    --catalog_ids       Takes the file system indices of backup files recorded  \n"
+        "                        in the catalog instead of querying each file. Existence \n"
+        "                        of backup files is not checked then, except for files   \n"
+        "                        hashed by --verify_hash. Snapshots not recording indices\n"
+        "                        are queried as before.                                  \n"
+        "                                                                                \n"
+        "    --verify_ids        Compares the file system indices recorded in the catalog\n"
+        "                        with the ones of the backup files, e.g., after copying a\n"
+        "                        repository to another file system.                      \n"
+        "                                                                                \n"
         "    --write_file_table  creates a CSV file containing a file table with all     \n"
         "                        backup files and their properties. Files which are      \n"
         "                        referenced with multiple hard links occur only once,    \n"
@@ -75,6 +86,7 @@ bool CCmdVerify::Run(const std::vector<CPath>& paths, const COptions& options)
     CLogger::GetInstance().EnableDebugLog(options.GetBool("verbose"));
     CLogger::GetInstance().Init("");
     options.Log();
+    LOG_DEBUG("hash implementations: " + CHasher::StaticGetImplementationNames(), COLOR_DEBUG);
 
     std::vector<CPath> snapshotPaths = paths;
     if (snapshotPaths.size() == 1 && !CSnapshot::StaticIsExsting(snapshotPaths.back()))
@@ -127,14 +139,38 @@ bool CCmdVerify::Run(const std::vector<CPath>& paths, const COptions& options)
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void CCmdVerify::VerifyFiles(CFileTable& fileTable, const CSnapshot& snapshot, int snapshotIdx, const COptions& options)
 {
-    std::vector<CRepoFile> repoFiles = snapshot.FindAllFiles({});
-    for (auto& repoFile : repoFiles)
+    // files are streamed, only the ones of the current hash batch are kept
+    std::vector<CRepoFile>          hashBatchFiles;
+    std::vector<CRepoFile*>         hashBatch;
+    std::vector<unsigned long long> hashBatchIndices;
+    hashBatchFiles.reserve(CRepoFile::HASH_BATCH_SIZE);
+
+    auto iterator = snapshot.IterateFiles({});
+    while (iterator.HasFile())
     {
+        CRepoFile& repoFile = iterator.ReadNextFile();
         LOG_DEBUG("verifying: " + repoFile.ToString(), COLOR_VERIFY);
 
         CFileTable::CEntry* fileTableEntry = nullptr;
 
-        unsigned long long fileSystemIndex = repoFile.GetFileSystemIndex();
+        // the indices recorded since catalog version 6 spare querying each file
+        unsigned long long fileSystemIndex = static_cast<unsigned long long>(-1);
+        if (options.GetBool("catalog_ids") && !options.GetBool("verify_ids") && repoFile.GetFileId().IsSpecified())
+        {
+            fileSystemIndex = repoFile.GetFileId().GetIndex();
+        }
+        else
+        {
+            fileSystemIndex = repoFile.GetFileSystemIndex();
+
+            // device numbers of removable disks change between mounts, only the index is compared
+            if (options.GetBool("verify_ids") && repoFile.GetFileId().IsSpecified()
+                && fileSystemIndex != static_cast<unsigned long long>(-1) && fileSystemIndex != repoFile.GetFileId().GetIndex())
+            {
+                CLogger::GetInstance().LogError("file system index differs from catalog: " + repoFile.ToString());
+            }
+        }
+
         if (fileSystemIndex == static_cast<unsigned long long>(-1))
         {
             CLogger::GetInstance().LogError("cannot read file system index: " + repoFile.ToString());
@@ -147,7 +183,7 @@ void CCmdVerify::VerifyFiles(CFileTable& fileTable, const CSnapshot& snapshot, i
             {
                 if (fileTableEntry->mRepoFile.GetHash() != repoFile.GetHash())
                 {
-                    CLogger::GetInstance().LogError("inconsistent hash: " + repoFile.ToString() + " DB: " + repoFile.GetHash() + " repo file: " + fileTableEntry->mRepoFile.GetHash());
+                    CLogger::GetInstance().LogError("inconsistent hash: " + repoFile.ToString() + " DB: " + repoFile.GetHash().ToString() + " repo file: " + fileTableEntry->mRepoFile.GetHash().ToString());
                 }
                 else
                 {
@@ -157,18 +193,36 @@ void CCmdVerify::VerifyFiles(CFileTable& fileTable, const CSnapshot& snapshot, i
             }
         }
 
+        if (options.GetBool("verify_hash") && repoFile.GetSize() <= CRepoFile::HASH_BATCH_MAX_BYTES)
+        {
+            // the entry holds the database hash until the batch is hashed
+            if (fileTableEntry != nullptr)
+            {
+                fileTableEntry->mRepoFile = repoFile;
+            }
+            hashBatchFiles.push_back(repoFile);
+            hashBatch.push_back(&hashBatchFiles.back());
+            hashBatchIndices.push_back(fileTableEntry != nullptr ? fileSystemIndex : static_cast<unsigned long long>(-1));
+            if (hashBatch.size() >= CRepoFile::HASH_BATCH_SIZE)
+            {
+                VerifyHashBatch(fileTable, hashBatch, hashBatchIndices);
+                hashBatchFiles.clear();
+            }
+            continue;
+        }
+
         if (options.GetBool("verify_hash"))
         {
-            std::string lastHash = repoFile.GetHash();
+            CHash lastHash = repoFile.GetHash();
             LOG_DEBUG("hashing: " + repoFile.ToString(), COLOR_HASH);
             if (!repoFile.Hash())
             {
                 CLogger::GetInstance().LogError("cannot hash: " + repoFile.ToString());
-                repoFile.SetHash("ERROR");
+                repoFile.SetHash({});
             }
             else if (lastHash != repoFile.GetHash())
             {
-                CLogger::GetInstance().LogError("inconsistent hash: " + repoFile.ToString() + " DB: " + lastHash + " repo file: " + repoFile.GetHash());
+                CLogger::GetInstance().LogError("inconsistent hash: " + repoFile.ToString() + " DB: " + lastHash.ToString() + " repo file: " + repoFile.GetHash().ToString());
             }
         }
 
@@ -177,4 +231,42 @@ void CCmdVerify::VerifyFiles(CFileTable& fileTable, const CSnapshot& snapshot, i
             fileTableEntry->mRepoFile = repoFile;
         }
     }
+
+    VerifyHashBatch(fileTable, hashBatch, hashBatchIndices);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CCmdVerify::VerifyHashBatch(CFileTable& fileTable, std::vector<CRepoFile*>& repoFiles, std::vector<unsigned long long>& fileSystemIndices)
+{
+    std::vector<CHash> lastHashes;
+    for (auto repoFile : repoFiles)
+    {
+        LOG_DEBUG("hashing: " + repoFile->ToString(), COLOR_HASH);
+        lastHashes.push_back(repoFile->GetHash());
+    }
+
+    CRepoFile::StaticHashBatch(repoFiles);
+
+    for (size_t i = 0; i < repoFiles.size(); i++)
+    {
+        CRepoFile& repoFile = *repoFiles[i];
+        if (!repoFile.HasHash())
+        {
+            CLogger::GetInstance().LogError("cannot hash: " + repoFile.ToString());
+            repoFile.SetHash({});
+        }
+        else if (lastHashes[i] != repoFile.GetHash())
+        {
+            CLogger::GetInstance().LogError("inconsistent hash: " + repoFile.ToString() + " DB: " + lastHashes[i].ToString() + " repo file: " + repoFile.GetHash().ToString());
+        }
+
+        if (fileSystemIndices[i] != static_cast<unsigned long long>(-1))
+        {
+            fileTable.GetEntry(fileSystemIndices[i]).mRepoFile = repoFile;
+        }
+    }
+
+    repoFiles.clear();
+    fileSystemIndices.clear();
 }
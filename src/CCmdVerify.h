@@ -19,4 +19,5 @@ public:
 private:
     void PrintHelp();
     void VerifyFiles(CFileTable& fileTable, const CSnapshot& snapshot, int snapshotIdx, const COptions& options);
+    void VerifyHashBatch(CFileTable& fileTable, std::vector<CRepoFile*>& repoFiles, std::vector<unsigned long long>& fileSystemIndices);
 };
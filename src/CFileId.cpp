@@ -0,0 +1,90 @@
+#include "CFileId.h"
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#   undef CreateDirectory
+#else
+#   include <sys/stat.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CFileId CFileId::StaticFromPath(const CPath& path)
+{
+#ifdef _WIN32
+    // no access rights needed for querying file information
+    HANDLE handle = ::CreateFileW(
+        path.wstring().c_str(),
+        0,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS,
+        nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return {};
+    }
+
+    BY_HANDLE_FILE_INFORMATION fileInformation;
+    if (!::GetFileInformationByHandle(handle, &fileInformation))
+    {
+        ::CloseHandle(handle);
+        return {};
+    }
+    ::CloseHandle(handle);
+
+    return
+    {
+        fileInformation.dwVolumeSerialNumber,
+        (static_cast<unsigned long long>(fileInformation.nFileIndexHigh) << 32)
+            + static_cast<unsigned long long>(fileInformation.nFileIndexLow)
+    };
+#else
+    struct stat fileStat;
+    if (::stat(path.string().c_str(), &fileStat) < 0)
+    {
+        return {};
+    }
+
+    return { static_cast<unsigned long long>(fileStat.st_dev), static_cast<unsigned long long>(fileStat.st_ino) };
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CFileId::CFileId(unsigned long long device, unsigned long long index)
+    :
+    mDevice(device),
+    mIndex(index),
+    mIsSpecified(true)
+{}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CFileId::IsSpecified() const
+{
+    return mIsSpecified;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned long long CFileId::GetDevice() const
+{
+    return mDevice;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned long long CFileId::GetIndex() const
+{
+    return mIndex;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CFileId::operator == (const CFileId& other) const
+{
+    return mIsSpecified == other.mIsSpecified && mDevice == other.mDevice && mIndex == other.mIndex;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "CPath.h"
+
+// identifies a file on its file system independent of its path, i.e., device and inode number
+class CFileId
+{
+public: // static
+    // returns an unspecified id if the file cannot be accessed
+    static CFileId StaticFromPath(const CPath& path);
+
+public:
+    CFileId() = default;
+    CFileId(CFileId&&) = default;
+    CFileId(const CFileId&) = default;
+
+    CFileId(unsigned long long device, unsigned long long index);
+
+    bool                IsSpecified() const;
+    unsigned long long  GetDevice() const;
+    unsigned long long  GetIndex() const;
+
+    bool operator == (const CFileId& other) const;
+
+    CFileId& operator = (CFileId&& other) = default;
+    CFileId& operator = (const CFileId& other) = default;
+
+private:
+    unsigned long long  mDevice         = 0;
+    unsigned long long  mIndex          = 0;
+    bool                mIsSpecified    = false;
+};
@@ -0,0 +1,243 @@
+#include "CFileReader.h"
+
+#include <new>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#   undef CreateDirectory
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <errno.h>
+#endif
+
+#include "Helpers.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CFileReader::CAlignedDeleter::operator () (unsigned char* buffer) const
+{
+    ::operator delete[](buffer, std::align_val_t(BLOCK_ALIGNMENT));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CFileReader::CFileReader(size_t blockSize)
+    :
+#ifdef _WIN32
+    mHandle(INVALID_HANDLE_VALUE),
+#else
+    mFileDescriptor(-1),
+#endif
+    // block size is rounded up to the alignment, keeping all reads page aligned
+    mBlockSize((blockSize + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT)
+{
+    VERIFY(mBlockSize > 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CFileReader::~CFileReader()
+{
+    Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CFileReader::Open(const CPath& path, bool lock)
+{
+    Close();
+
+#ifdef _WIN32
+    // locking is done by denying write access to others
+    mHandle = ::CreateFileW(
+        path.wstring().c_str(),
+        GENERIC_READ,
+        lock ? FILE_SHARE_READ : FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN,
+        nullptr);
+    if (mHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+#else
+    mFileDescriptor = ::open(path.string().c_str(), O_RDONLY | O_CLOEXEC);
+    if (mFileDescriptor < 0)
+    {
+        return false;
+    }
+    if (lock)
+    {
+        flock fl = { F_RDLCK, SEEK_SET, 0, 0, 0 };
+        if (::fcntl(mFileDescriptor, F_SETLK, &fl) == -1)
+        {
+            Close();
+            return false;
+        }
+    }
+    ::posix_fadvise(mFileDescriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    mPosition   = 0;
+    mEndOfFile  = false;
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CFileReader::Close()
+{
+#ifdef _WIN32
+    if (mHandle != INVALID_HANDLE_VALUE)
+    {
+        ::CloseHandle(mHandle);
+        mHandle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (mFileDescriptor >= 0)
+    {
+        ::close(mFileDescriptor);
+        mFileDescriptor = -1;
+    }
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CFileReader::IsOpen() const
+{
+#ifdef _WIN32
+    return mHandle != INVALID_HANDLE_VALUE;
+#else
+    return mFileDescriptor >= 0;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CFileReader::Rewind()
+{
+    mPosition   = 0;
+    mEndOfFile  = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+long long CFileReader::GetPosition() const
+{
+    return mPosition;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CFileReader::ReadBlock(const unsigned char*& data, size_t& size)
+{
+    VERIFY(IsOpen());
+
+    // allocated on first use, small files are usually read directly into the caller's buffer
+    if (!mBuffer)
+    {
+        mBuffer.reset(static_cast<unsigned char*>(::operator new[](mBlockSize, std::align_val_t(BLOCK_ALIGNMENT))));
+    }
+
+    // a short read already hit the end, spare the extra system call
+    if (mEndOfFile)
+    {
+        data = mBuffer.get();
+        size = 0;
+        return true;
+    }
+
+    // let the kernel fetch the following block while the caller processes this one
+    AdviseWillNeed(mPosition + static_cast<long long>(mBlockSize), mBlockSize);
+
+    size_t bytesRead = 0;
+    if (!ReadAt(mPosition, mBuffer.get(), mBlockSize, bytesRead))
+    {
+        return false;
+    }
+
+    mPosition   += static_cast<long long>(bytesRead);
+    mEndOfFile  = bytesRead < mBlockSize;
+    data = mBuffer.get();
+    size = bytesRead;
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CFileReader::Read(unsigned char* buffer, size_t size, size_t& bytesRead)
+{
+    VERIFY(IsOpen());
+
+    if (!ReadAt(mPosition, buffer, size, bytesRead))
+    {
+        return false;
+    }
+
+    mPosition   += static_cast<long long>(bytesRead);
+    mEndOfFile  = bytesRead < size;
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CFileReader::ReadAt(long long offset, unsigned char* buffer, size_t size, size_t& bytesRead)
+{
+    bytesRead = 0;
+    while (bytesRead < size)
+    {
+#ifdef _WIN32
+        OVERLAPPED overlapped   = {};
+        long long position      = offset + static_cast<long long>(bytesRead);
+        overlapped.Offset       = static_cast<DWORD>(position & 0xFFFFFFFF);
+        overlapped.OffsetHigh   = static_cast<DWORD>(position >> 32);
+
+        DWORD chunkRead = 0;
+        if (!::ReadFile(mHandle, buffer + bytesRead, static_cast<DWORD>(size - bytesRead), &chunkRead, &overlapped))
+        {
+            if (::GetLastError() == ERROR_HANDLE_EOF)
+            {
+                return true;
+            }
+            return false;
+        }
+#else
+        ssize_t chunkRead = ::pread(mFileDescriptor, buffer + bytesRead, size - bytesRead, offset + static_cast<long long>(bytesRead));
+        if (chunkRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+#endif
+        if (chunkRead == 0)
+        {
+            return true;
+        }
+        bytesRead += static_cast<size_t>(chunkRead);
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CFileReader::AdviseWillNeed(long long offset, size_t size)
+{
+#ifdef _WIN32
+    // read-ahead is requested via FILE_FLAG_SEQUENTIAL_SCAN on open
+    (void)offset;
+    (void)size;
+#else
+    ::posix_fadvise(mFileDescriptor, offset, static_cast<off_t>(size), POSIX_FADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include <cstddef>
+
+#include "CPath.h"
+
+class CFileReader
+{
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE  = 1 << 20;
+    static constexpr size_t BLOCK_ALIGNMENT     = 4096;
+
+public:
+    CFileReader(size_t blockSize = DEFAULT_BLOCK_SIZE);
+    CFileReader(const CFileReader&) = delete;
+    ~CFileReader();
+
+    bool Open(const CPath& path, bool lock);
+    void Close();
+    bool IsOpen() const;
+
+    void        Rewind();
+    long long   GetPosition() const;
+
+    // returns a pointer to the next block, valid until the next call. size is 0 at end of file
+    bool ReadBlock(const unsigned char*& data, size_t& size);
+
+    // reads into the caller's buffer, bypassing the block buffer. bytesRead is less than size at end of file
+    bool Read(unsigned char* buffer, size_t size, size_t& bytesRead);
+
+    CFileReader& operator = (const CFileReader&) = delete;
+
+private:
+    struct CAlignedDeleter
+    {
+        void operator () (unsigned char* buffer) const;
+    };
+
+    bool ReadAt(long long offset, unsigned char* buffer, size_t size, size_t& bytesRead);
+    void AdviseWillNeed(long long offset, size_t size);
+
+#ifdef _WIN32
+    void*   mHandle;
+#else
+    int     mFileDescriptor;
+#endif
+    size_t                                              mBlockSize;
+    std::unique_ptr<unsigned char[], CAlignedDeleter>   mBuffer;
+    long long                                           mPosition = 0;
+    bool                                                mEndOfFile = false;
+};
@@ -78,6 +78,7 @@ void CFileTable::VerifyFileSignatureUniqueness() const
         if (file1.GetSize() == file2.GetSize()
             && file1.GetTime() == file2.GetTime()
             && file1.GetSourcePath() == file2.GetSourcePath()
+            && file1.GetHashAlgorithm() == file2.GetHashAlgorithm()
             && file1.GetHash() != file2.GetHash())
         {
             CLogger::GetInstance().LogError("files with same signature but different hash: " + file1.SourceToString() + " and " + file2.SourceToString());
@@ -0,0 +1,107 @@
+#include "CHash.h"
+
+#include <cstring>
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static int HexDigitValue(char digit)
+{
+    if (digit >= '0' && digit <= '9')
+    {
+        return digit - '0';
+    }
+    if (digit >= 'a' && digit <= 'f')
+    {
+        return digit - 'a' + 10;
+    }
+    if (digit >= 'A' && digit <= 'F')
+    {
+        return digit - 'A' + 10;
+    }
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CHash CHash::StaticFromHex(const std::string& hex)
+{
+    if (hex.size() != 2 * SIZE)
+    {
+        throw "invalid hash: " + hex;
+    }
+
+    unsigned char bytes[SIZE];
+    for (size_t i = 0; i < SIZE; i++)
+    {
+        int high    = HexDigitValue(hex[2 * i]);
+        int low     = HexDigitValue(hex[2 * i + 1]);
+        if (high < 0 || low < 0)
+        {
+            throw "invalid hash: " + hex;
+        }
+        bytes[i] = static_cast<unsigned char>(high << 4 | low);
+    }
+
+    return bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CHash::CHash(const unsigned char* bytes)
+    :
+    mIsSpecified(true)
+{
+    std::memcpy(mBytes, bytes, SIZE);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CHash::IsSpecified() const
+{
+    return mIsSpecified;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const unsigned char* CHash::GetBytes() const
+{
+    return mBytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CHash::ToString() const
+{
+    if (!mIsSpecified)
+    {
+        return "";
+    }
+
+    std::string result(2 * SIZE, '0');
+    for (size_t i = 0; i < SIZE; i++)
+    {
+        result[2 * i]       = HEX_DIGITS[mBytes[i] >> 4];
+        result[2 * i + 1]   = HEX_DIGITS[mBytes[i] & 0x0F];
+    }
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CHash::operator == (const CHash& other) const
+{
+    return mIsSpecified == other.mIsSpecified && std::memcmp(mBytes, other.mBytes, SIZE) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CHash::operator < (const CHash& other) const
+{
+    if (mIsSpecified != other.mIsSpecified)
+    {
+        return !mIsSpecified;
+    }
+    return std::memcmp(mBytes, other.mBytes, SIZE) < 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+class CHash
+{
+public:
+    static constexpr size_t SIZE = 32;
+
+public: // static
+    // parses the hex representation stored by catalogs before the binary format
+    static CHash StaticFromHex(const std::string& hex);
+
+public:
+    CHash() = default;
+    CHash(CHash&&) = default;
+    CHash(const CHash&) = default;
+
+    CHash(const unsigned char* bytes);
+
+    bool                    IsSpecified() const;
+    const unsigned char*    GetBytes() const;
+    std::string             ToString() const;
+
+    bool operator == (const CHash& other) const;
+    bool operator < (const CHash& other) const;
+
+    CHash& operator = (CHash&& other) = default;
+    CHash& operator = (const CHash& other) = default;
+
+private:
+    unsigned char   mBytes[SIZE]    = {};
+    bool            mIsSpecified    = false;
+};
@@ -0,0 +1,54 @@
+#include "CHashAlgorithm.h"
+
+#include "Helpers.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CHashAlgorithm CHashAlgorithm::StaticFromString(const std::string& name)
+{
+    for (EValue value : { SHA256, BLAKE3 })
+    {
+        if (Helpers::ToLower(name) == CHashAlgorithm(value).ToString())
+        {
+            return value;
+        }
+    }
+
+    throw "unknown hash algorithm: " + name;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CHashAlgorithm::CHashAlgorithm(EValue value)
+    :
+    mValue(value)
+{}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CHashAlgorithm::operator EValue() const
+{
+    return mValue;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CHashAlgorithm::IsSpecified() const
+{
+    return mValue != UNSPECIFIED;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CHashAlgorithm::ToString() const
+{
+    switch (mValue)
+    {
+    case SHA256:
+        return "sha256";
+    case BLAKE3:
+        return "blake3";
+    default:
+        return "";
+    }
+}
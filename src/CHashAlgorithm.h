@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+
+class CHashAlgorithm
+{
+public:
+    enum EValue
+    {
+        UNSPECIFIED,
+        SHA256,
+        BLAKE3,
+    };
+
+public: // static
+    static CHashAlgorithm StaticFromString(const std::string& name);
+
+public:
+    CHashAlgorithm() = default;
+    CHashAlgorithm(CHashAlgorithm&&) = default;
+    CHashAlgorithm(const CHashAlgorithm&) = default;
+
+    CHashAlgorithm(EValue value);
+
+    operator EValue() const;
+
+    bool        IsSpecified() const;
+    std::string ToString() const;
+
+    CHashAlgorithm& operator = (CHashAlgorithm&& other) = default;
+    CHashAlgorithm& operator = (const CHashAlgorithm& other) = default;
+
+private:
+    EValue mValue = UNSPECIFIED;
+};
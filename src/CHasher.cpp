@@ -0,0 +1,75 @@
+#include "CHasher.h"
+
+#include "CThreadPool.h"
+#include "Helpers.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CHasher::StaticGetImplementationNames()
+{
+    return "sha256: " + CSha256::StaticGetImplementationName()
+        + ", sha256 batch: " + CSha256::StaticGetBatchImplementationName()
+        + ", blake3: " + CBlake3::StaticGetImplementationName()
+        + " on " + std::to_string(CThreadPool::GetInstance().GetThreadCount()) + " threads";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::vector<CHash> CHasher::StaticHashBatch(CHashAlgorithm algorithm, const std::vector<std::vector<unsigned char>>& messages)
+{
+    if (algorithm == CHashAlgorithm::SHA256)
+    {
+        return CSha256::StaticHashBatch(messages);
+    }
+
+    std::vector<CHash> digests;
+    CHasher hasher(algorithm);
+    for (auto& message : messages)
+    {
+        hasher.Update(message.data(), message.size());
+        digests.push_back(hasher.Finalize());
+    }
+    return digests;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CHasher::CHasher(CHashAlgorithm algorithm)
+    :
+    mAlgorithm(algorithm)
+{
+    VERIFY(mAlgorithm.IsSpecified());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CHasher::Update(const void* data, size_t size)
+{
+    switch (mAlgorithm)
+    {
+    case CHashAlgorithm::SHA256:
+        mSha256.Update(data, size);
+        break;
+    case CHashAlgorithm::BLAKE3:
+        mBlake3.Update(data, size);
+        break;
+    default:
+        VERIFY(false);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CHash CHasher::Finalize()
+{
+    switch (mAlgorithm)
+    {
+    case CHashAlgorithm::SHA256:
+        return mSha256.Finalize();
+    case CHashAlgorithm::BLAKE3:
+        return mBlake3.Finalize();
+    default:
+        VERIFY(false);
+        return {};
+    }
+}
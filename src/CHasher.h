@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "CHashAlgorithm.h"
+#include "CSha256.h"
+#include "CBlake3.h"
+
+class CHasher
+{
+public: // static
+    static std::string StaticGetImplementationNames();
+
+    // all messages are hashed with the same algorithm, digests are returned in the same order
+    static std::vector<CHash> StaticHashBatch(CHashAlgorithm algorithm, const std::vector<std::vector<unsigned char>>& messages);
+
+public:
+    CHasher(CHashAlgorithm algorithm);
+
+    void        Update(const void* data, size_t size);
+    CHash       Finalize();
+
+private:
+    CHashAlgorithm  mAlgorithm;
+    CSha256         mSha256;
+    CBlake3         mBlake3;
+};
@@ -0,0 +1,399 @@
+#include "CManifest.h"
+
+#include <fstream>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cstring>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#   undef CreateDirectory
+#else
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#include "Helpers.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CManifest::CWriter::Add(const CRepoFile& file)
+{
+    std::string source = StaticPathToString(file.GetSourcePath());
+    std::string relative = StaticPathToString(file.GetRelativePath());
+
+    SRecord record = {};
+    record.mSourceOffset    = mHeap.size();
+    record.mSourceLength    = static_cast<uint32_t>(source.size());
+    mHeap.append(source);
+    record.mFileOffset      = mHeap.size();
+    record.mFileLength      = static_cast<uint32_t>(relative.size());
+    mHeap.append(relative);
+
+    record.mSize = file.GetSize();
+    record.mTime = file.GetTime();
+    std::memcpy(record.mHash, file.GetHash().GetBytes(), CHash::SIZE);
+    if (file.GetSourceId().IsSpecified())
+    {
+        record.mFlags           |= FLAG_SOURCE_ID;
+        record.mSourceDevice    = file.GetSourceId().GetDevice();
+        record.mSourceIndex     = file.GetSourceId().GetIndex();
+    }
+    if (file.GetSourceChangeTime().IsSpecified())
+    {
+        record.mFlags           |= FLAG_SOURCE_CHANGE_TIME;
+        record.mSourceChangeTime = file.GetSourceChangeTime();
+    }
+    if (file.GetFileId().IsSpecified())
+    {
+        record.mFlags           |= FLAG_FILE_ID;
+        record.mFileDevice      = file.GetFileId().GetDevice();
+        record.mFileIndex       = file.GetFileId().GetIndex();
+    }
+
+    mRecords.push_back(record);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CManifest::CWriter::Save(const CPath& path, long long catalogSize, long long catalogTime)
+{
+    if (mRecords.size() > std::numeric_limits<uint32_t>::max())
+    {
+        return false;
+    }
+
+    // signature order, the byte-wise order of the source strings as in the catalog
+    const char* heap = mHeap.data();
+    std::sort(mRecords.begin(), mRecords.end(), [heap](const SRecord& a, const SRecord& b)
+    {
+        int order = StaticGetSource(a, heap).compare(StaticGetSource(b, heap));
+        if (order != 0)
+        {
+            return order < 0;
+        }
+        if (a.mSize != b.mSize)
+        {
+            return a.mSize < b.mSize;
+        }
+        if (a.mTime != b.mTime)
+        {
+            return a.mTime < b.mTime;
+        }
+        return StaticGetFile(a, heap) < StaticGetFile(b, heap);
+    });
+
+    std::vector<uint32_t> hashOrder(mRecords.size());
+    std::iota(hashOrder.begin(), hashOrder.end(), 0);
+    std::stable_sort(hashOrder.begin(), hashOrder.end(), [this](uint32_t a, uint32_t b)
+    {
+        return std::memcmp(mRecords[a].mHash, mRecords[b].mHash, CHash::SIZE) < 0;
+    });
+
+    SHeader header = {};
+    std::memcpy(header.mMagic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.mRecordCount = mRecords.size();
+    header.mHeapSize    = mHeap.size();
+    header.mCatalogSize = catalogSize;
+    header.mCatalogTime = catalogTime;
+
+    // written next to the target first, so a manifest is either complete or missing
+    CPath tempPath = path;
+    tempPath += ".tmp";
+
+    // written in native byte order like the filter, a manifest failing to open is ignored
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(mRecords.data()), mRecords.size() * sizeof(SRecord));
+    file.write(reinterpret_cast<const char*>(hashOrder.data()), hashOrder.size() * sizeof(uint32_t));
+    file.write(mHeap.data(), mHeap.size());
+    file.close();
+
+    std::error_code errorCode;
+    if (file.fail())
+    {
+        std::filesystem::remove(tempPath, errorCode);
+        return false;
+    }
+
+    Helpers::MakeWritable(path);
+    std::filesystem::rename(tempPath, path, errorCode);
+    if (errorCode)
+    {
+        std::filesystem::remove(tempPath, errorCode);
+        return false;
+    }
+
+    return Helpers::MakeReadOnly(path);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CManifest::~CManifest()
+{
+    Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CManifest::Open(const CPath& path, long long catalogSize, long long catalogTime)
+{
+    static_assert(sizeof(SHeader) % 8 == 0 && sizeof(SRecord) % 8 == 0, "records must stay aligned");
+
+    VERIFY(!IsOpen());
+
+#ifdef _WIN32
+    HANDLE file = ::CreateFileW(
+        path.wstring().c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!::GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(SHeader)))
+    {
+        ::CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    ::CloseHandle(file);
+    if (mapping == nullptr)
+    {
+        return false;
+    }
+
+    void* data = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    ::CloseHandle(mapping);
+    if (data == nullptr)
+    {
+        return false;
+    }
+    mDataSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int file = ::open(path.string().c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (::fstat(file, &fileStat) < 0 || fileStat.st_size < static_cast<off_t>(sizeof(SHeader)))
+    {
+        ::close(file);
+        return false;
+    }
+
+    // the mapping stays valid after the file is closed
+    void* data = ::mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_SHARED, file, 0);
+    ::close(file);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    mDataSize = static_cast<size_t>(fileStat.st_size);
+#endif
+    mData = static_cast<const char*>(data);
+
+    const SHeader* header = reinterpret_cast<const SHeader*>(mData);
+    if (std::memcmp(header->mMagic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0
+        || header->mCatalogSize != catalogSize
+        || header->mCatalogTime != catalogTime
+        || header->mRecordCount > std::numeric_limits<uint32_t>::max()
+        || header->mHeapSize > mDataSize
+        || mDataSize != sizeof(SHeader) + header->mRecordCount * (sizeof(SRecord) + sizeof(uint32_t)) + header->mHeapSize)
+    {
+        Close();
+        return false;
+    }
+
+    mCount      = static_cast<size_t>(header->mRecordCount);
+    mRecords    = reinterpret_cast<const SRecord*>(mData + sizeof(SHeader));
+    mHashOrder  = reinterpret_cast<const uint32_t*>(mData + sizeof(SHeader) + mCount * sizeof(SRecord));
+    mHeap       = mData + sizeof(SHeader) + mCount * (sizeof(SRecord) + sizeof(uint32_t));
+
+    // checked once here, so reads never leave the mapping
+    uint64_t heapSize = header->mHeapSize;
+    for (size_t i = 0; i < mCount; i++)
+    {
+        const SRecord& record = mRecords[i];
+        if (record.mSourceOffset > heapSize || record.mSourceLength > heapSize - record.mSourceOffset
+            || record.mFileOffset > heapSize || record.mFileLength > heapSize - record.mFileOffset
+            || mHashOrder[i] >= mCount)
+        {
+            Close();
+            return false;
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CManifest::Close()
+{
+    if (mData == nullptr)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    ::UnmapViewOfFile(mData);
+#else
+    ::munmap(const_cast<char*>(mData), mDataSize);
+#endif
+    mData       = nullptr;
+    mDataSize   = 0;
+    mRecords    = nullptr;
+    mHashOrder  = nullptr;
+    mHeap       = nullptr;
+    mCount      = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CManifest::IsOpen() const
+{
+    return mData != nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t CManifest::GetFileCount() const
+{
+    return mCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CManifest::ReadFile(size_t index, CRepoFile& file, CPath& pathBuffer) const
+{
+    VERIFY(index < mCount);
+    const SRecord& record = mRecords[index];
+
+    std::string_view source = StaticGetSource(record, mHeap);
+    pathBuffer.assign(std::u8string_view(reinterpret_cast<const char8_t*>(source.data()), source.size()));
+    file.SetSourcePath(pathBuffer);
+    file.SetSize(static_cast<long long>(record.mSize));
+    file.SetTime(static_cast<long long>(record.mTime));
+    file.SetHash(record.mHash);
+
+    std::string_view relative = StaticGetFile(record, mHeap);
+    pathBuffer.assign(std::u8string_view(reinterpret_cast<const char8_t*>(relative.data()), relative.size()));
+    file.SetRelativePath(pathBuffer);
+
+    file.SetSourceId((record.mFlags & FLAG_SOURCE_ID) ? CFileId(record.mSourceDevice, record.mSourceIndex) : CFileId());
+    file.SetSourceChangeTime((record.mFlags & FLAG_SOURCE_CHANGE_TIME) ? CTime(static_cast<long long>(record.mSourceChangeTime)) : CTime());
+    file.SetFileId((record.mFlags & FLAG_FILE_ID) ? CFileId(record.mFileDevice, record.mFileIndex) : CFileId());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CManifest::FindFiles(const CRepoFile& constraints, std::vector<size_t>& indices) const
+{
+    indices.clear();
+
+    if (!constraints.GetSourcePath().empty())
+    {
+        std::string source = StaticPathToString(constraints.GetSourcePath());
+        auto begin = std::partition_point(mRecords, mRecords + mCount,
+            [this, &source](const SRecord& record) { return StaticGetSource(record, mHeap) < source; });
+        for (auto it = begin; it != mRecords + mCount && StaticGetSource(*it, mHeap) == source; ++it)
+        {
+            if (Matches(*it, constraints))
+            {
+                indices.push_back(it - mRecords);
+            }
+        }
+        return true;
+    }
+
+    if (constraints.HasHash())
+    {
+        const unsigned char* hash = constraints.GetHash().GetBytes();
+        auto begin = std::partition_point(mHashOrder, mHashOrder + mCount,
+            [this, hash](uint32_t index) { return std::memcmp(mRecords[index].mHash, hash, CHash::SIZE) < 0; });
+        for (auto it = begin; it != mHashOrder + mCount && std::memcmp(mRecords[*it].mHash, hash, CHash::SIZE) == 0; ++it)
+        {
+            if (Matches(mRecords[*it], constraints))
+            {
+                indices.push_back(*it);
+            }
+        }
+        return true;
+    }
+
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CManifest::Matches(const SRecord& record, const CRepoFile& constraints) const
+{
+    // the constraints of CSnapshot::DBFormatConstraints
+    if (!constraints.GetSourcePath().empty() && StaticGetSource(record, mHeap) != StaticPathToString(constraints.GetSourcePath()))
+    {
+        return false;
+    }
+    if (constraints.GetSize().IsSpecified() && record.mSize != constraints.GetSize())
+    {
+        return false;
+    }
+    if (constraints.GetTime().IsSpecified() && record.mTime != constraints.GetTime())
+    {
+        return false;
+    }
+    if (constraints.HasHash() && std::memcmp(record.mHash, constraints.GetHash().GetBytes(), CHash::SIZE) != 0)
+    {
+        return false;
+    }
+    if (!constraints.GetRelativePath().empty() && StaticGetFile(record, mHeap) != StaticPathToString(constraints.GetRelativePath()))
+    {
+        return false;
+    }
+    if (constraints.GetSourceId().IsSpecified()
+        && (!(record.mFlags & FLAG_SOURCE_ID)
+            || record.mSourceDevice != constraints.GetSourceId().GetDevice()
+            || record.mSourceIndex != constraints.GetSourceId().GetIndex()))
+    {
+        return false;
+    }
+    if (constraints.GetSourceChangeTime().IsSpecified()
+        && (!(record.mFlags & FLAG_SOURCE_CHANGE_TIME) || record.mSourceChangeTime != constraints.GetSourceChangeTime()))
+    {
+        return false;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string_view CManifest::StaticGetSource(const SRecord& record, const char* heap)
+{
+    return { heap + record.mSourceOffset, record.mSourceLength };
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string_view CManifest::StaticGetFile(const SRecord& record, const char* heap)
+{
+    return { heap + record.mFileOffset, record.mFileLength };
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CManifest::StaticPathToString(const CPath& path)
+{
+    return Helpers::ReinterpretU8StringAsString(path.u8string());
+}
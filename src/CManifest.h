@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#include "CPath.h"
+#include "CRepoFile.h"
+
+// immutable file list of a finished snapshot, read through a memory mapping. Records have a fixed
+// width and are sorted by signature, a second table orders them by hash. Paths are stored in a
+// string heap the records refer to
+class CManifest
+{
+private: // types
+    struct SRecord
+    {
+        uint64_t    mSourceOffset;
+        uint64_t    mFileOffset;
+        uint32_t    mSourceLength;
+        uint32_t    mFileLength;
+        int64_t     mSize;
+        int64_t     mTime;
+        int64_t     mSourceChangeTime;
+        uint64_t    mSourceDevice;
+        uint64_t    mSourceIndex;
+        uint64_t    mFileDevice;
+        uint64_t    mFileIndex;
+        uint32_t    mFlags;
+        uint8_t     mHash[CHash::SIZE];
+        uint32_t    mReserved;
+    };
+
+    struct SHeader
+    {
+        char        mMagic[8];
+        uint64_t    mRecordCount;
+        uint64_t    mHeapSize;
+        int64_t     mCatalogSize;
+        int64_t     mCatalogTime;
+    };
+
+public: // types
+    // collects the files of a snapshot in any order, they are sorted when saved
+    class CWriter
+    {
+    public:
+        void Add(const CRepoFile& file);
+
+        // catalogSize and catalogTime identify the catalog the files were read from
+        bool Save(const CPath& path, long long catalogSize, long long catalogTime);
+
+    private:
+        std::vector<SRecord>    mRecords;
+        std::string             mHeap;
+    };
+
+public:
+    CManifest() = default;
+    CManifest(const CManifest&) = delete;
+    ~CManifest();
+
+    // returns false if the file is missing, invalid or written for another catalog
+    bool Open(const CPath& path, long long catalogSize, long long catalogTime);
+    void Close();
+    bool IsOpen() const;
+
+    // files are numbered in signature order
+    size_t  GetFileCount() const;
+    void    ReadFile(size_t index, CRepoFile& file, CPath& pathBuffer) const;
+
+    // searches the signature order if the source path is given, the hash order otherwise. Returns
+    // false if neither is given, the constraints have to be searched in the catalog then
+    bool    FindFiles(const CRepoFile& constraints, std::vector<size_t>& indices) const;
+
+    CManifest& operator = (const CManifest&) = delete;
+
+private:
+    static std::string_view StaticGetSource(const SRecord& record, const char* heap);
+    static std::string_view StaticGetFile(const SRecord& record, const char* heap);
+    static std::string      StaticPathToString(const CPath& path);
+
+    bool Matches(const SRecord& record, const CRepoFile& constraints) const;
+
+    const char*     mData       = nullptr;
+    size_t          mDataSize   = 0;
+    const SRecord*  mRecords    = nullptr;
+    const uint32_t* mHashOrder  = nullptr;
+    const char*     mHeap       = nullptr;
+    size_t          mCount      = 0;
+
+    inline static const uint32_t    FLAG_SOURCE_ID          = 1;
+    inline static const uint32_t    FLAG_SOURCE_CHANGE_TIME = 2;
+    inline static const uint32_t    FLAG_FILE_ID            = 4;
+
+    inline static const char        FILE_MAGIC[8]       = { 'B', 'K', 'M', 'A', 'N', 'I', 'F', '1' };
+};
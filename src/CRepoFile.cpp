@@ -3,22 +3,19 @@
 #include <thread>
 #include <iomanip>
 #include <regex>
+#include <fstream>
 
 #ifdef _WIN32
 #   define WIN32_LEAN_AND_MEAN
 #   include <windows.h>
-#   include <io.h> 
 #   undef CreateDirectory
 #else
 #   include <sys/stat.h>
-#   include <fcntl.h>
-#   include <ext/stdio_filebuf.h>
 #endif
 
-#include "picosha2.h"
-
 #include "COptions.h"
 #include "CLogger.h"
+#include "CHasher.h"
 #include "Helpers.h"
 
 #ifdef _WIN32
@@ -41,22 +38,124 @@ long long CRepoFile::sBytesLinked   = 0;
 long long CRepoFile::sBytesCopied   = 0;
 long long CRepoFile::sBytesDeleted  = 0;
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void ReadSourceStatus(const CPath& path, CFileId& fileId, CTime& changeTime)
+{
+    fileId      = {};
+    changeTime  = {};
+
+#ifdef _WIN32
+    HANDLE handle = ::CreateFileW(
+        path.wstring().c_str(),
+        0,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS,
+        nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    BY_HANDLE_FILE_INFORMATION fileInformation;
+    FILE_BASIC_INFO basicInformation;
+    if (::GetFileInformationByHandle(handle, &fileInformation)
+        && ::GetFileInformationByHandleEx(handle, FileBasicInfo, &basicInformation, sizeof(basicInformation)))
+    {
+        fileId = {
+            fileInformation.dwVolumeSerialNumber,
+            (static_cast<unsigned long long>(fileInformation.nFileIndexHigh) << 32)
+                + static_cast<unsigned long long>(fileInformation.nFileIndexLow) };
+        changeTime = std::chrono::file_clock::time_point(std::chrono::file_clock::duration(basicInformation.ChangeTime.QuadPart));
+    }
+    ::CloseHandle(handle);
+#else
+    struct stat fileStat;
+    if (::stat(path.string().c_str(), &fileStat) < 0)
+    {
+        return;
+    }
+
+    fileId = { static_cast<unsigned long long>(fileStat.st_dev), static_cast<unsigned long long>(fileStat.st_ino) };
+    changeTime = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::seconds(fileStat.st_ctim.tv_sec) + std::chrono::nanoseconds(fileStat.st_ctim.tv_nsec)));
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static bool HashReader(CFileReader& reader, CHashAlgorithm algorithm, CHash& hash)
+{
+    CHasher hasher(algorithm);
+
+    const unsigned char* data;
+    size_t size;
+    do
+    {
+        if (!reader.ReadBlock(data, size))
+        {
+            return false;
+        }
+        hasher.Update(data, size);
+    }
+    while (size > 0);
+
+    hash = hasher.Finalize();
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static bool ReadContent(CFileReader& reader, long long expectedSize, std::vector<unsigned char>& content)
+{
+    // one byte more than expected reveals a file that has grown meanwhile
+    content.resize(static_cast<size_t>(expectedSize) + 1);
+
+    size_t totalRead = 0;
+    while (true)
+    {
+        size_t bytesRead;
+        if (!reader.Read(content.data() + totalRead, content.size() - totalRead, bytesRead))
+        {
+            return false;
+        }
+        totalRead += bytesRead;
+        if (totalRead < content.size())
+        {
+            break;
+        }
+        content.resize(2 * content.size());
+    }
+    content.resize(totalRead);
+
+    return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 CRepoFile::CRepoFile(
     CPath           sourcePath,
     CSize           size,
     CTime           time,
-    std::string     hash,
+    CHash           hash,
     CPath           relativePath,
-    CPath           parentPath)
+    CPath           parentPath,
+    CHashAlgorithm  hashAlgorithm,
+    CFileId         sourceId,
+    CTime           sourceChangeTime)
     :
     mSourcePath(sourcePath),
     mSize(size),
     mTime(time),
     mHash(hash),
     mRelativePath(relativePath),
-    mParentPath(parentPath)
+    mParentPath(parentPath),
+    mHashAlgorithm(hashAlgorithm),
+    mSourceId(sourceId),
+    mSourceChangeTime(sourceChangeTime)
 {}
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -82,7 +181,7 @@ CTime CRepoFile::GetTime() const
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-const std::string& CRepoFile::GetHash() const
+const CHash& CRepoFile::GetHash() const
 {
     return mHash;
 }
@@ -91,7 +190,7 @@ const std::string& CRepoFile::GetHash() const
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 bool CRepoFile::HasHash() const
 {
-    return !mHash.empty();
+    return mHash.IsSpecified();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -108,6 +207,34 @@ CPath CRepoFile::GetParentPath() const
     return mParentPath;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CHashAlgorithm CRepoFile::GetHashAlgorithm() const
+{
+    return mHashAlgorithm;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CFileId CRepoFile::GetSourceId() const
+{
+    return mSourceId;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CTime CRepoFile::GetSourceChangeTime() const
+{
+    return mSourceChangeTime;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CFileId CRepoFile::GetFileId() const
+{
+    return mFileId;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 CPath CRepoFile::GetFullPath() const
@@ -138,7 +265,7 @@ void CRepoFile::SetTime(CTime time)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-void CRepoFile::SetHash(const std::string& hash)
+void CRepoFile::SetHash(const CHash& hash)
 {
     mHash = hash;
 }
@@ -157,6 +284,34 @@ void CRepoFile::SetParentPath(const CPath& parentPath)
     mParentPath = parentPath;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepoFile::SetHashAlgorithm(CHashAlgorithm hashAlgorithm)
+{
+    mHashAlgorithm = hashAlgorithm;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepoFile::SetSourceId(CFileId sourceId)
+{
+    mSourceId = sourceId;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepoFile::SetSourceChangeTime(CTime sourceChangeTime)
+{
+    mSourceChangeTime = sourceChangeTime;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepoFile::SetFileId(CFileId fileId)
+{
+    mFileId = fileId;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 bool CRepoFile::IsExisting() const
@@ -212,6 +367,9 @@ bool CRepoFile::ReadSourceProperties()
     }
     SetTime(time);
 
+    // optional, only used for finding moved files and for the extended signature
+    ReadSourceStatus(GetSourcePath(), mSourceId, mSourceChangeTime);
+
     return true;
 }
 
@@ -224,28 +382,13 @@ bool CRepoFile::LockSource()
         return true;
     }
 
-    mSourceFileHandle = std::make_shared<std::ifstream>();
+    mSourceFileHandle = std::make_shared<CFileReader>();
     for (int i = 0; i < 10; i++)
     {
-#ifdef _WIN32
-        mSourceFileHandle->open(mSourcePath.wstring(), std::ios::binary, _SH_DENYWR);
-        if (mSourceFileHandle->is_open())
+        if (mSourceFileHandle->Open(mSourcePath, true))
         {
             return true;
         }
-#else
-        mSourceFileHandle->open(mSourcePath.string(), std::ios::binary);
-        if (mSourceFileHandle->is_open())
-        {
-            flock fl = { F_RDLCK, SEEK_SET, 0, 0, 0 };
-            int fd = static_cast<__gnu_cxx::stdio_filebuf<char> *const>(mSourceFileHandle->rdbuf())->fd();
-            if (::fcntl(fd, F_SETFD, &fl) != -1)
-            {
-                return true;
-            }
-            mSourceFileHandle->close();
-        }
-#endif
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
     mSourceFileHandle.reset();
@@ -264,7 +407,7 @@ void CRepoFile::UnlockSource()
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 bool CRepoFile::IsSourceLocked()
 {
-    return mSourceFileHandle->is_open();
+    return mSourceFileHandle && mSourceFileHandle->IsOpen();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -276,10 +419,100 @@ bool CRepoFile::HashSource()
         return false;
     }
 
-    mHash = picosha2::hash256_hex_string(std::istreambuf_iterator<char>(*mSourceFileHandle), std::istreambuf_iterator<char>());
+    mSourceFileHandle->Rewind();
+    if (!HashReader(*mSourceFileHandle, mHashAlgorithm, mHash))
+    {
+        return false;
+    }
+
+    sFilesHashed++;
+    sBytesHashed += GetSize();
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CRepoFile::CopyAndHashSource()
+{
+    if (!LockSource())
+    {
+        return false;
+    }
+
+    std::error_code errorCode;
+
+    if (!Helpers::CreateDirectory(GetFullPath().parent_path()))
+    {
+        return false;
+    }
+
+    if (std::filesystem::exists(GetFullPath()))
+    {
+        CLogger::GetInstance().LogWarning("cannot copy, target exists: " + ToString() + " from: " + SourceToString());
+        return false;
+    }
+
+    std::ofstream targetHandle(GetFullPath(), std::ios::binary);
+    if (!targetHandle.is_open())
+    {
+        CLogger::GetInstance().LogWarning("cannot create: " + ToString());
+        return false;
+    }
+
+    // read the source once, feeding both the copy and the hash
+    CHasher hasher(mHashAlgorithm);
+    const unsigned char* data;
+    size_t size = 0;
+    bool readable = true;
+    mSourceFileHandle->Rewind();
+    do
+    {
+        readable = mSourceFileHandle->ReadBlock(data, size);
+        if (!readable)
+        {
+            break;
+        }
+        hasher.Update(data, size);
+        targetHandle.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+    }
+    while (size > 0 && targetHandle.good());
+
+    targetHandle.close();
+    if (!readable || targetHandle.fail())
+    {
+        CLogger::GetInstance().LogWarning("cannot copy: " + ToString() + " from: " + SourceToString());
+        std::filesystem::remove(GetFullPath(), errorCode);
+        return false;
+    }
+
+    mHash = hasher.Finalize();
 
     sFilesHashed++;
     sBytesHashed += GetSize();
+    sFilesCopied++;
+    sBytesCopied += GetSize();
+
+    if (GetSize() < HARD_LINK_MIN_BYTES)
+    {
+        LOG_DEBUG("copied (small): " + ToString() + " from: " + mSourcePath.string(), COLOR_COPY_SMALL);
+    }
+    else
+    {
+        LOG_DEBUG("copied: " + ToString() + " from: " + mSourcePath.string(), COLOR_COPY);
+    }
+
+    std::filesystem::permissions(GetFullPath(), std::filesystem::status(mSourcePath).permissions(), errorCode);
+    if (errorCode)
+    {
+        CLogger::GetInstance().LogWarning("cannot set permissions of " + ToString(), errorCode);
+    }
+
+    std::filesystem::last_write_time(GetFullPath(), mTime, errorCode);
+    if (errorCode)
+    {
+        CLogger::GetInstance().LogWarning("cannot set modification time of " + ToString(), errorCode);
+    }
 
     return true;
 }
@@ -288,13 +521,16 @@ bool CRepoFile::HashSource()
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 bool CRepoFile::Hash()
 {
-    std::ifstream fileHandle(GetFullPath().string(), std::ios::binary);
-    if (!fileHandle.is_open())
+    CFileReader fileHandle;
+    if (!fileHandle.Open(GetFullPath(), false))
     {
         return false;
     }
 
-    mHash = picosha2::hash256_hex_string(std::istreambuf_iterator<char>(fileHandle), std::istreambuf_iterator<char>());
+    if (!HashReader(fileHandle, mHashAlgorithm, mHash))
+    {
+        return false;
+    }
 
     sFilesHashed++;
     sBytesHashed += GetSize();
@@ -375,6 +611,49 @@ bool CRepoFile::Link(const CPath& source) const
     return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CRepoFile::ReplaceByLink(const CPath& source) const
+{
+    if (GetSize() < HARD_LINK_MIN_BYTES)
+    {
+        // small files are never linked, the copy is kept
+        return true;
+    }
+
+    std::error_code errorCode;
+
+    // link next to the copy first, so the copy is only replaced once the link exists
+    CPath linkPath = GetFullPath();
+    linkPath += ".link_tmp";
+
+    std::filesystem::create_hard_link(source, linkPath, errorCode);
+    if (errorCode)
+    {
+        CLogger::GetInstance().LogWarning("cannot link: " + ToString() + " from: " + source.string(), errorCode);
+        return false;
+    }
+
+    Helpers::MakeWritable(GetFullPath());
+    std::filesystem::rename(linkPath, GetFullPath(), errorCode);
+    if (errorCode)
+    {
+        CLogger::GetInstance().LogWarning("cannot replace by link: " + ToString() + " from: " + source.string(), errorCode);
+        std::filesystem::remove(linkPath, errorCode);
+        return false;
+    }
+
+    // the copy is gone, account for the file as linked only
+    sFilesCopied--;
+    sBytesCopied -= GetSize();
+    sFilesLinked++;
+    sBytesLinked += GetSize();
+
+    LOG_DEBUG("replaced by link: " + ToString() + " from: " + source.string(), COLOR_LINK);
+
+    return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 bool CRepoFile::Delete()
@@ -457,12 +736,86 @@ std::string CRepoFile::ToCSV() const
     std::ostringstream ss;
     ss << std::setw(12) << mSize
         << ","      << Helpers::TimeAsString(mTime, true)
-        << ","      << mHash
+        << ","      << (HasHash() ? mHash.ToString() : "ERROR")
         << ",\""    << std::regex_replace(GetFullPath().string(), regex, "\"\"") << "\""
         << ",\""    << std::regex_replace(GetSourcePath().string(), regex, "\"\"") << "\"";
     return ss.str();
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepoFile::StaticHashSourceBatch(const std::vector<CRepoFile*>& files)
+{
+    std::vector<std::vector<unsigned char>> contents(files.size());
+    std::vector<bool> readable(files.size(), false);
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        CRepoFile& file = *files[i];
+        file.mHash = {};
+        if (file.LockSource())
+        {
+            file.mSourceFileHandle->Rewind();
+            readable[i] = ReadContent(*file.mSourceFileHandle, file.GetSize(), contents[i]);
+        }
+    }
+
+    StaticHashContents(files, contents, readable);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepoFile::StaticHashBatch(const std::vector<CRepoFile*>& files)
+{
+    std::vector<std::vector<unsigned char>> contents(files.size());
+    std::vector<bool> readable(files.size(), false);
+
+    CFileReader fileHandle;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        CRepoFile& file = *files[i];
+        file.mHash = {};
+        if (fileHandle.Open(file.GetFullPath(), false))
+        {
+            readable[i] = ReadContent(fileHandle, file.GetSize(), contents[i]);
+        }
+    }
+    fileHandle.Close();
+
+    StaticHashContents(files, contents, readable);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepoFile::StaticHashContents(
+    const std::vector<CRepoFile*>&                  files,
+    const std::vector<std::vector<unsigned char>>&  contents,
+    const std::vector<bool>&                        readable)
+{
+    if (files.empty())
+    {
+        return;
+    }
+
+    CHashAlgorithm algorithm = files.front()->GetHashAlgorithm();
+    for (auto file : files)
+    {
+        VERIFY(file->GetHashAlgorithm() == algorithm);
+    }
+
+    std::vector<CHash> hashes = CHasher::StaticHashBatch(algorithm, contents);
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (readable[i])
+        {
+            files[i]->mHash = hashes[i];
+            sFilesHashed++;
+            sBytesHashed += files[i]->GetSize();
+        }
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void CRepoFile::StaticLogStats()
@@ -1,15 +1,24 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <memory>
-#include <fstream>
 
 #include "CPath.h"
+#include "CFileReader.h"
 #include "CSize.h"
 #include "CTime.h"
+#include "CHash.h"
+#include "CHashAlgorithm.h"
+#include "CFileId.h"
 
 class CRepoFile
 {
+public:
+    // files up to this size are hashed in batches of up to HASH_BATCH_SIZE files
+    static constexpr long long  HASH_BATCH_MAX_BYTES    = 16 * 1024;
+    static constexpr size_t     HASH_BATCH_SIZE         = 16;
+
 public:
     CRepoFile() = default;
     CRepoFile(CRepoFile&&) = default;
@@ -19,26 +28,39 @@ public:
         CPath           sourcePath,
         CSize           size,
         CTime           time,
-        std::string     hash,
+        CHash           hash,
         CPath           relativePath,
-        CPath           parentPath);
+        CPath           parentPath,
+        CHashAlgorithm  hashAlgorithm = {},
+        CFileId         sourceId = {},
+        CTime           sourceChangeTime = {});
 
     CPath               GetSourcePath() const;
     CSize               GetSize() const;
     CTime               GetTime() const;
-    const std::string&  GetHash() const;
+    const CHash&        GetHash() const;
     bool                HasHash() const;
     CPath               GetRelativePath() const;
     CPath               GetParentPath() const;
+    CHashAlgorithm      GetHashAlgorithm() const;
+    CFileId             GetSourceId() const;
+    CTime               GetSourceChangeTime() const;
+
+    // device and index of the backup file, as recorded in the catalog
+    CFileId             GetFileId() const;
 
     CPath GetFullPath() const;
 
     void SetSourcePath(const CPath& sourcePath);
     void SetSize(CSize size);
     void SetTime(CTime time);
-    void SetHash(const std::string& hash);
+    void SetHash(const CHash& hash);
     void SetRelativePath(const CPath& relativePath);
     void SetParentPath(const CPath& parentPath);
+    void SetHashAlgorithm(CHashAlgorithm hashAlgorithm);
+    void SetSourceId(CFileId sourceId);
+    void SetSourceChangeTime(CTime sourceChangeTime);
+    void SetFileId(CFileId fileId);
 
     bool IsExisting() const;
     bool IsLinkable() const;
@@ -47,6 +69,7 @@ public:
     bool LockSource();
     void UnlockSource();
     bool HashSource();
+    bool CopyAndHashSource();
     bool IsSourceLocked();
 
     bool Hash();
@@ -57,6 +80,7 @@ public:
 
     bool Copy(const CPath& source) const;
     bool Link(const CPath& source) const;
+    bool ReplaceByLink(const CPath& source) const;
 
     bool Delete();
 
@@ -68,17 +92,30 @@ public:
 public: // static
     static void StaticLogStats();
 
+    // all files must share one hash algorithm. Files that cannot be read are left without hash
+    static void StaticHashSourceBatch(const std::vector<CRepoFile*>& files);
+    static void StaticHashBatch(const std::vector<CRepoFile*>& files);
+
 private:
     CPath           mSourcePath;
     CSize           mSize;
     CTime           mTime;
-    std::string     mHash;
+    CHash           mHash;
     CPath           mRelativePath;
     CPath           mParentPath;
+    CHashAlgorithm  mHashAlgorithm;
+    CFileId         mSourceId;
+    CTime           mSourceChangeTime;
+    CFileId         mFileId;
 
-    std::shared_ptr<std::ifstream>   mSourceFileHandle;
+    std::shared_ptr<CFileReader>    mSourceFileHandle;
 
 private: // static
+    static void StaticHashContents(
+        const std::vector<CRepoFile*>&                  files,
+        const std::vector<std::vector<unsigned char>>&  contents,
+        const std::vector<bool>&                        readable);
+
     static long long   sFilesHashed;
     static long long   sFilesCopied;
     static long long   sFilesLinked;
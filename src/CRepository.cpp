@@ -4,6 +4,7 @@
 
 #include "CLogger.h"
 #include "Helpers.h"
+#include "CThreadPool.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -44,16 +45,19 @@ std::vector<CPath> CRepository::StaticGetSnapshotPaths(const CPath repositoryPat
     std::set<CPath> snapshotPaths;
     for (auto& p : std::filesystem::directory_iterator(repositoryPath))
     {
-        if (!std::filesystem::is_directory(p))
+        if (!std::filesystem::is_directory(p) || p.path().filename() == META_DATA_PATH)
         {
             continue;
         }
 
-        CSnapshot::StaticValidate(p.path());
         snapshotPaths.insert(p.path());
     }
+    std::vector<CPath> result(snapshotPaths.begin(), snapshotPaths.end());
 
-    return std::vector<CPath>(snapshotPaths.begin(), snapshotPaths.end());
+    // on cold caches each validation waits for the disk, they are issued concurrently
+    CThreadPool::GetInstance().Run(result.size(), [&](size_t i) { CSnapshot::StaticValidate(result[i]); });
+
+    return result;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -114,17 +118,42 @@ void CRepository::Open(const CPath& path, bool create)
         }
     }
 
-    for (auto& snapshotPath : StaticGetSnapshotPaths(mPath))
+    std::vector<CPath> snapshotPaths = StaticGetSnapshotPaths(mPath);
+    std::vector<std::shared_ptr<CSnapshot>> snapshots(snapshotPaths.size());
+    CThreadPool::GetInstance().Run(snapshotPaths.size(), [&](size_t i) { snapshots[i] = std::make_shared<CSnapshot>(snapshotPaths[i], false); });
+    mSnapshots = std::move(snapshots);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepository::Prefetch(size_t snapshotCount) const
+{
+    // the index and the newest catalogs are read first on a backup, reading them ahead as a whole
+    // replaces many random reads by few sequential ones
+    std::vector<std::shared_ptr<CSnapshot>> snapshots(
+        mSnapshots.end() - std::min(snapshotCount, mSnapshots.size()), mSnapshots.end());
+
+    CThreadPool::GetInstance().Run(snapshots.size() + 1, [&](size_t i)
     {
-        mSnapshots.emplace_back(std::make_unique<CSnapshot>(snapshotPath, false));
-    }
+        if (i == snapshots.size())
+        {
+            Helpers::ReadAhead(mPath / INDEX_FILE_PATH);
+        }
+        else
+        {
+            snapshots[i]->Prefetch();
+        }
+    });
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void CRepository::Close()
 {
+    mIndex.reset();
     mSnapshots.clear();
+    mKnownSizes.clear();
+    mKnownSizesLoaded = false;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -156,6 +185,15 @@ void CRepository::AttachSnapshot(std::shared_ptr<CSnapshot> snapshot)
         }
     }
     mSnapshots.emplace_back(snapshot);
+
+    if (mIndex)
+    {
+        mIndex->Include(*snapshot);
+    }
+    if (mKnownSizesLoaded && !mIndex->IsIndexed(*snapshot))
+    {
+        LoadKnownSizes(*snapshot);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -168,6 +206,10 @@ std::shared_ptr<CSnapshot> CRepository::DetachSnapshot(const CPath& snapshotPath
         {
             std::shared_ptr<CSnapshot> result = *it;
             mSnapshots.erase(it);
+            if (mIndex)
+            {
+                mIndex->Exclude(*result);
+            }
             return result;
         }
     }
@@ -178,9 +220,22 @@ std::shared_ptr<CSnapshot> CRepository::DetachSnapshot(const CPath& snapshotPath
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 CRepoFile CRepository::FindFile(const CRepoFile& constraints, bool preferLinkable) const
 {
+    CRepositoryIndex& index = GetIndex();
+
     CRepoFile unlinkableFile;
     for (int i = (int)mSnapshots.size() - 1; i >= 0; i--)
     {
+        if (index.IsIndexed(*mSnapshots[i]))
+        {
+            continue;
+        }
+
+        // hashes of different algorithms are not comparable, neither are signatures mapped to them
+        if (constraints.GetHashAlgorithm().IsSpecified() && mSnapshots[i]->GetHashAlgorithm() != constraints.GetHashAlgorithm())
+        {
+            continue;
+        }
+
         CRepoFile file = mSnapshots[i]->FindFile(constraints, preferLinkable);
         if (!file.HasHash())
         {
@@ -193,5 +248,76 @@ CRepoFile CRepository::FindFile(const CRepoFile& constraints, bool preferLinkabl
         unlinkableFile = file;
     }
 
+    CRepoFile file = index.FindFile(constraints, preferLinkable);
+    if (file.HasHash())
+    {
+        if (!preferLinkable || file.IsLinkable())
+        {
+            return file;
+        }
+        unlinkableFile = file;
+    }
+
     return unlinkableFile;
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CRepository::IsSizeKnown(CSize size)
+{
+    CRepositoryIndex& index = GetIndex();
+
+    if (!mKnownSizesLoaded)
+    {
+        for (auto& snapshot : mSnapshots)
+        {
+            if (!index.IsIndexed(*snapshot))
+            {
+                LoadKnownSizes(*snapshot);
+            }
+        }
+        mKnownSizesLoaded = true;
+    }
+
+    if (mKnownSizes.contains(size))
+    {
+        return true;
+    }
+    if (index.IsSizeKnown(size))
+    {
+        mKnownSizes.insert(size);
+        return true;
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepository::AddKnownSize(CSize size)
+{
+    VERIFY(size.IsSpecified());
+    mKnownSizes.insert(size);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CRepositoryIndex& CRepository::GetIndex() const
+{
+    if (!mIndex)
+    {
+        mIndex = std::make_unique<CRepositoryIndex>(mPath, mPath / INDEX_FILE_PATH);
+        mIndex->Synchronize(mSnapshots);
+    }
+
+    return *mIndex;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepository::LoadKnownSizes(const CSnapshot& snapshot)
+{
+    for (long long size : snapshot.FindAllSizes())
+    {
+        mKnownSizes.insert(size);
+    }
+}
@@ -2,11 +2,13 @@
 
 #include <vector>
 #include <memory>
+#include <unordered_set>
 
 #include "Helpers.h"
 #include "CPath.h"
 #include "CRepoFile.h"
 #include "CSnapshot.h"
+#include "CRepositoryIndex.h"
 
 class CRepository
 {
@@ -24,15 +26,35 @@ public:
     void Open(const CPath& path, bool create);
     void Close();
 
+    // reads the repository index and the catalogs of the newest snapshots into the file system cache
+    void Prefetch(size_t snapshotCount) const;
+
     const std::vector<std::shared_ptr<CSnapshot>>&  GetAllSnapshots() const;
 
     void                        AttachSnapshot(std::shared_ptr<CSnapshot> snapshot);
     std::shared_ptr<CSnapshot>  DetachSnapshot(const CPath& snapshotPath);
 
 
+    // snapshots finished before the first search are looked up in the repository index,
+    // snapshots attached afterwards, e.g., the one in progress, are searched one by one
     CRepoFile FindFile(const CRepoFile& constraints, bool preferLinkable) const;
 
+    // a file can only have a duplicate if a file of the same size exists. Sizes of indexed snapshots
+    // are looked up in the repository index, the ones of the other snapshots are loaded on first use.
+    // Sizes of files added afterwards must be registered via AddKnownSize
+    bool IsSizeKnown(CSize size);
+    void AddKnownSize(CSize size);
+
 private:
+    CRepositoryIndex& GetIndex() const;
+    void LoadKnownSizes(const CSnapshot& snapshot);
+
     CPath                                       mPath;
     std::vector<std::shared_ptr<CSnapshot>>     mSnapshots;
+    std::unordered_set<long long>               mKnownSizes;
+    bool                                        mKnownSizesLoaded = false;
+    mutable std::unique_ptr<CRepositoryIndex>   mIndex;
+
+    inline static const CPath   META_DATA_PATH      = ".backup";
+    inline static const CPath   INDEX_FILE_PATH     = META_DATA_PATH / "index.sqlite";
 };
@@ -0,0 +1,507 @@
+#include "CRepositoryIndex.h"
+
+#include <unordered_map>
+#include <optional>
+#include <algorithm>
+
+#include "CLogger.h"
+#include "Helpers.h"
+#include "CThreadPool.h"
+
+// the index mirrors the columns of the catalogs
+static constexpr bool DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME = true;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CRepositoryIndex::SStamp CRepositoryIndex::StaticGetStamp(const CSnapshot& snapshot)
+{
+    std::error_code errorCode;
+    auto size = std::filesystem::file_size(snapshot.GetDatabasePath(), errorCode);
+    if (errorCode)
+    {
+        throw "cannot read size of catalog: " + snapshot.GetDatabasePath().string() + ": " + errorCode.message();
+    }
+    auto time = std::filesystem::last_write_time(snapshot.GetDatabasePath(), errorCode);
+    if (errorCode)
+    {
+        throw "cannot read modification time of catalog: " + snapshot.GetDatabasePath().string() + ": " + errorCode.message();
+    }
+
+    return { static_cast<long long>(size), static_cast<long long>(time.time_since_epoch().count()) };
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CRepositoryIndex::CRepositoryIndex(const CPath& repositoryPath, const CPath& indexPath)
+    :
+    mRepositoryPath(repositoryPath),
+    mIndexPath(indexPath)
+{
+    DBInit();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CRepositoryIndex::~CRepositoryIndex()
+{
+    Helpers::TryCatch([this]() { mSqliteDB.Close(); });
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepositoryIndex::Synchronize(const std::vector<std::shared_ptr<CSnapshot>>& snapshots)
+{
+    struct SIndexedSnapshot
+    {
+        long long   mId;
+        SStamp      mStamp;
+    };
+
+    std::unordered_map<std::string, SIndexedSnapshot> indexedSnapshots;
+    auto statement = mSqliteDB.StartQuery("select ID, NAME, DB_SIZE, DB_TIME from SNAPSHOTS");
+    while (statement.HasData())
+    {
+        indexedSnapshots[statement.ReadString(1)] = { statement.ReadInt(0), { statement.ReadInt(2), statement.ReadInt(3) } };
+    }
+    statement.Finalize();
+
+    mSnapshotIds.clear();
+    mExcludedSnapshotIds.clear();
+
+    // the stamps are a few file system queries per snapshot, issued concurrently
+    std::vector<std::optional<SStamp>> stamps(snapshots.size());
+    CThreadPool::GetInstance().Run(snapshots.size(), [&](size_t i)
+    {
+        if (!snapshots[i]->IsInProgress())
+        {
+            stamps[i] = StaticGetStamp(*snapshots[i]);
+        }
+    });
+
+    struct SImport
+    {
+        size_t  mSnapshotIndex;
+        SStamp  mStamp;
+    };
+
+    std::vector<SImport> imports;
+    for (size_t i = 0; i < snapshots.size(); i++)
+    {
+        auto& snapshot = snapshots[i];
+        std::string name = PathToDBString(snapshot->GetAbsolutePath().filename());
+        auto it = indexedSnapshots.find(name);
+
+        // the catalog of a snapshot in progress is still changing, it is searched directly
+        if (!stamps[i])
+        {
+            if (it != indexedSnapshots.end())
+            {
+                DBRemove(it->second.mId);
+                indexedSnapshots.erase(it);
+            }
+            continue;
+        }
+
+        SStamp stamp = *stamps[i];
+        if (it != indexedSnapshots.end())
+        {
+            if (it->second.mStamp == stamp)
+            {
+                mSnapshotIds[name] = it->second.mId;
+                indexedSnapshots.erase(it);
+                continue;
+            }
+            DBRemove(it->second.mId);
+            indexedSnapshots.erase(it);
+        }
+
+        imports.push_back({ i, stamp });
+    }
+
+    // the remaining ones are either detached or deleted
+    for (auto& [name, indexedSnapshot] : indexedSnapshots)
+    {
+        if (CSnapshot::StaticIsExsting(mRepositoryPath / DBStringToPath(name)))
+        {
+            mSnapshotIds[name] = indexedSnapshot.mId;
+            mExcludedSnapshotIds.insert(indexedSnapshot.mId);
+        }
+        else
+        {
+            DBRemove(indexedSnapshot.mId);
+        }
+    }
+
+    // imported in name order, so new snapshots usually get the next id
+    std::sort(imports.begin(), imports.end(), [&](const SImport& a, const SImport& b)
+    {
+        return snapshots[a.mSnapshotIndex]->GetAbsolutePath().filename() < snapshots[b.mSnapshotIndex]->GetAbsolutePath().filename();
+    });
+    for (auto& import : imports)
+    {
+        CSnapshot& snapshot = *snapshots[import.mSnapshotIndex];
+        CLogger::GetInstance().Log("indexing snapshot: " + snapshot.GetAbsolutePath().string());
+        if (!DBImport(snapshot, import.mStamp))
+        {
+            // no id left between the neighbours of an older snapshot added late, the index starts over
+            CLogger::GetInstance().Log("rebuilding repository index: " + mIndexPath.string());
+            mSqliteDB.RunQuery("delete from FILES");
+            mSqliteDB.RunQuery("delete from SNAPSHOTS");
+            Synchronize(snapshots);
+            return;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CRepositoryIndex::IsIndexed(const CSnapshot& snapshot) const
+{
+    return mSnapshotIds.contains(PathToDBString(snapshot.GetAbsolutePath().filename()));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepositoryIndex::Exclude(const CSnapshot& snapshot)
+{
+    auto it = mSnapshotIds.find(PathToDBString(snapshot.GetAbsolutePath().filename()));
+    if (it != mSnapshotIds.end())
+    {
+        mExcludedSnapshotIds.insert(it->second);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepositoryIndex::Include(const CSnapshot& snapshot)
+{
+    auto it = mSnapshotIds.find(PathToDBString(snapshot.GetAbsolutePath().filename()));
+    if (it != mSnapshotIds.end())
+    {
+        mExcludedSnapshotIds.erase(it->second);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CRepoFile CRepositoryIndex::FindFile(const CRepoFile& constraints, bool preferLinkable) const
+{
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME, "TODO");
+
+    // ids ascend with the snapshot names, so rows come newest first straight from the indices on
+    // (..., SNAPSHOT) without sorting. The cross join keeps FILES the outer table
+    auto statement = mSqliteDB.StartCachedQuery(
+        "select F.SNAPSHOT, S.NAME, S.HASH_ALGORITHM, F.SOURCE, F.SIZE, F.TIME, F.HASH, F.FILE, F.SOURCE_DEVICE, F.SOURCE_INODE, F.SOURCE_CTIME "
+        "from FILES F cross join SNAPSHOTS S on S.ID = F.SNAPSHOT"
+        + DBFormatConstraints(constraints)
+        + " order by F.SNAPSHOT desc");
+    DBBindConstraints(statement, constraints);
+
+    CRepoFile unlinkableFile;
+    while (statement.HasData())
+    {
+        size_t hashSize = 0;
+        const unsigned char* hashBytes = statement.ReadBlob(6, hashSize);
+        VERIFY(hashSize == CHash::SIZE);
+
+        CFileId sourceId;
+        if (!statement.IsNull(8) && !statement.IsNull(9))
+        {
+            sourceId = { static_cast<unsigned long long>(statement.ReadInt(8)), static_cast<unsigned long long>(statement.ReadInt(9)) };
+        }
+
+        CRepoFile file(
+            DBStringToPath(statement.ReadString(3)),
+            statement.ReadInt(4),
+            statement.ReadInt(5),
+            hashBytes,
+            DBStringToPath(statement.ReadString(7)),
+            mRepositoryPath / DBStringToPath(statement.ReadString(1)),
+            CHashAlgorithm::StaticFromString(statement.ReadString(2)),
+            sourceId,
+            statement.IsNull(10) ? CTime() : CTime(statement.ReadInt(10)));
+
+        if (!preferLinkable || file.IsLinkable())
+        {
+            return file;
+        }
+        unlinkableFile = file;
+    }
+
+    return unlinkableFile;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CRepositoryIndex::IsSizeKnown(CSize size) const
+{
+    auto statement = mSqliteDB.StartCachedQuery("select 1 from FILES where SIZE = ?1 limit 1");
+    statement.BindInt(1, size);
+    bool result = statement.HasData();
+    statement.Finalize();
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepositoryIndex::DBInit()
+{
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME, "TODO");
+
+    if (!std::filesystem::exists(mIndexPath.parent_path()))
+    {
+        std::error_code errorCode;
+        if (!std::filesystem::create_directories(mIndexPath.parent_path(), errorCode))
+        {
+            throw "cannot create index directory: " + mIndexPath.parent_path().string() + ": " + errorCode.message();
+        }
+    }
+
+    // each snapshot is imported in one transaction, so an interrupted import leaves no partial rows
+    mSqliteDB = CSqliteWrapper(mIndexPath, false);
+    mSqliteDB.RunQuery("pragma locking_mode = exclusive");
+    mSqliteDB.RunQuery("pragma cache_size = 1000000");
+    mSqliteDB.RunQuery("pragma synchronous = off");
+    mSqliteDB.RunQuery("pragma secure_delete = off");
+
+    auto versionStatement = mSqliteDB.StartQuery("pragma user_version");
+    VERIFY(versionStatement.HasData());
+    int formatVersion = static_cast<int>(versionStatement.ReadInt(0));
+    versionStatement.Finalize();
+    if (formatVersion != DB_FORMAT_VERSION)
+    {
+        mSqliteDB.RunQuery("drop table if exists FILES");
+        mSqliteDB.RunQuery("drop table if exists SNAPSHOTS");
+        mSqliteDB.RunQuery("pragma user_version = " + std::to_string(DB_FORMAT_VERSION));
+    }
+
+    mSqliteDB.RunQuery("create table if not exists SNAPSHOTS (ID integer primary key, NAME text not null unique, HASH_ALGORITHM text not null, DB_SIZE integer not null, DB_TIME integer not null)");
+    mSqliteDB.RunQuery("create table if not exists FILES (SNAPSHOT integer not null, SOURCE text not null, SIZE integer not null, TIME integer not null, HASH blob not null, FILE text not null, SOURCE_DEVICE integer, SOURCE_INODE integer, SOURCE_CTIME integer)");
+    mSqliteDB.RunQuery("create index if not exists FILES_SOURCE_SIZE_TIME_SNAPSHOT on FILES (SOURCE, SIZE, TIME, SNAPSHOT)");
+    mSqliteDB.RunQuery("create index if not exists FILES_HASH_SNAPSHOT on FILES (HASH, SNAPSHOT)");
+    mSqliteDB.RunQuery("create index if not exists FILES_SIZE on FILES (SIZE)");
+    mSqliteDB.RunQuery("create index if not exists FILES_SOURCE_INODE_SNAPSHOT on FILES (SOURCE_INODE, SNAPSHOT)");
+    mSqliteDB.RunQuery("create index if not exists FILES_SNAPSHOT on FILES (SNAPSHOT)");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CRepositoryIndex::DBImport(CSnapshot& snapshot, const SStamp& stamp)
+{
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME, "TODO");
+
+    std::string name = PathToDBString(snapshot.GetAbsolutePath().filename());
+
+    // ids are spaced, so a snapshot sorting between others still finds a free id in between
+    auto lowerStatement = mSqliteDB.StartCachedQuery("select max(ID) from SNAPSHOTS where NAME < ?1");
+    lowerStatement.BindString(1, name);
+    VERIFY(lowerStatement.HasData());
+    long long lowerId = lowerStatement.IsNull(0) ? 0 : lowerStatement.ReadInt(0);
+    lowerStatement.Finalize();
+
+    auto upperStatement = mSqliteDB.StartCachedQuery("select min(ID) from SNAPSHOTS where NAME > ?1");
+    upperStatement.BindString(1, name);
+    VERIFY(upperStatement.HasData());
+    long long snapshotId = upperStatement.IsNull(0) ? lowerId + SNAPSHOT_ID_SPACING : lowerId + (upperStatement.ReadInt(0) - lowerId) / 2;
+    upperStatement.Finalize();
+    if (snapshotId == lowerId)
+    {
+        return false;
+    }
+
+    mSqliteDB.RunQuery("begin");
+
+    auto snapshotStatement = mSqliteDB.StartCachedQuery("insert into SNAPSHOTS (ID, NAME, HASH_ALGORITHM, DB_SIZE, DB_TIME) values (?1, ?2, ?3, ?4, ?5)");
+    snapshotStatement.BindInt(1, snapshotId);
+    snapshotStatement.BindString(2, name);
+    snapshotStatement.BindString(3, snapshot.GetHashAlgorithm().ToString());
+    snapshotStatement.BindInt(4, stamp.mSize);
+    snapshotStatement.BindInt(5, stamp.mTime);
+    snapshotStatement.Execute();
+    snapshotStatement.Finalize();
+
+    auto iterator = snapshot.IterateFiles({});
+    while (iterator.HasFile())
+    {
+        CRepoFile file = iterator.GetNextFile();
+
+        auto statement = mSqliteDB.StartCachedQuery("insert into FILES values (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9)");
+        statement.BindInt(1, snapshotId);
+        statement.BindString(2, PathToDBString(file.GetSourcePath()));
+        statement.BindInt(3, file.GetSize());
+        statement.BindInt(4, file.GetTime());
+        statement.BindBlob(5, file.GetHash().GetBytes(), CHash::SIZE);
+        statement.BindString(6, PathToDBString(file.GetRelativePath()));
+        if (file.GetSourceId().IsSpecified())
+        {
+            statement.BindInt(7, static_cast<long long>(file.GetSourceId().GetDevice()));
+            statement.BindInt(8, static_cast<long long>(file.GetSourceId().GetIndex()));
+        }
+        else
+        {
+            statement.BindNull(7);
+            statement.BindNull(8);
+        }
+        if (file.GetSourceChangeTime().IsSpecified())
+        {
+            statement.BindInt(9, file.GetSourceChangeTime());
+        }
+        else
+        {
+            statement.BindNull(9);
+        }
+        statement.Execute();
+        statement.Finalize();
+    }
+
+    mSqliteDB.RunQuery("commit");
+
+    mSnapshotIds[name] = snapshotId;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepositoryIndex::DBRemove(long long snapshotId)
+{
+    mSqliteDB.RunQuery("begin");
+
+    auto filesStatement = mSqliteDB.StartCachedQuery("delete from FILES where SNAPSHOT = ?1");
+    filesStatement.BindInt(1, snapshotId);
+    filesStatement.Execute();
+    filesStatement.Finalize();
+
+    auto snapshotStatement = mSqliteDB.StartCachedQuery("delete from SNAPSHOTS where ID = ?1");
+    snapshotStatement.BindInt(1, snapshotId);
+    snapshotStatement.Execute();
+    snapshotStatement.Finalize();
+
+    mSqliteDB.RunQuery("commit");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CRepositoryIndex::DBFormatConstraints(const CRepoFile& constraints) const
+{
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME, "TODO");
+
+    // same parameter numbers as the catalogs, plus the hash algorithm of the snapshot.
+    // Rows imported from catalogs without source id or ctime have nulls, never matching these
+    std::vector<std::string> constraintStrings;
+    if (!constraints.GetSourcePath().empty())
+    {
+        constraintStrings.push_back("F.SOURCE=?1");
+    }
+    if (constraints.GetSize().IsSpecified())
+    {
+        constraintStrings.push_back("F.SIZE=?2");
+    }
+    if (constraints.GetTime().IsSpecified())
+    {
+        constraintStrings.push_back("F.TIME=?3");
+    }
+    if (constraints.HasHash())
+    {
+        constraintStrings.push_back("F.HASH=?4");
+    }
+    if (!constraints.GetRelativePath().empty())
+    {
+        constraintStrings.push_back("F.FILE=?5");
+    }
+    if (constraints.GetSourceId().IsSpecified())
+    {
+        constraintStrings.push_back("F.SOURCE_INODE=?7");
+        constraintStrings.push_back("F.SOURCE_DEVICE=?6");
+    }
+    if (constraints.GetSourceChangeTime().IsSpecified())
+    {
+        constraintStrings.push_back("F.SOURCE_CTIME=?8");
+    }
+    if (constraints.GetHashAlgorithm().IsSpecified())
+    {
+        constraintStrings.push_back("S.HASH_ALGORITHM=?9");
+    }
+
+    // the few excluded snapshots are part of the query text, their rows are never returned
+    if (!mExcludedSnapshotIds.empty())
+    {
+        std::string excludedIds;
+        for (long long id : mExcludedSnapshotIds)
+        {
+            excludedIds += (excludedIds.empty() ? "" : ",") + std::to_string(id);
+        }
+        constraintStrings.push_back("F.SNAPSHOT not in (" + excludedIds + ")");
+    }
+
+    std::string result;
+    if (!constraintStrings.empty())
+    {
+        result += " WHERE ";
+        for (auto& constraint : constraintStrings)
+        {
+            result += constraint;
+            if (&constraint != &constraintStrings.back())
+            {
+                result += " AND ";
+            }
+        }
+    }
+
+    return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CRepositoryIndex::DBBindConstraints(CSqliteWrapper::CStatement& statement, const CRepoFile& constraints) const
+{
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME, "TODO");
+
+    if (!constraints.GetSourcePath().empty())
+    {
+        statement.BindString(1, PathToDBString(constraints.GetSourcePath()));
+    }
+    if (constraints.GetSize().IsSpecified())
+    {
+        statement.BindInt(2, constraints.GetSize());
+    }
+    if (constraints.GetTime().IsSpecified())
+    {
+        statement.BindInt(3, constraints.GetTime());
+    }
+    if (constraints.HasHash())
+    {
+        statement.BindBlob(4, constraints.GetHash().GetBytes(), CHash::SIZE);
+    }
+    if (!constraints.GetRelativePath().empty())
+    {
+        statement.BindString(5, PathToDBString(constraints.GetRelativePath()));
+    }
+    if (constraints.GetSourceId().IsSpecified())
+    {
+        statement.BindInt(6, static_cast<long long>(constraints.GetSourceId().GetDevice()));
+        statement.BindInt(7, static_cast<long long>(constraints.GetSourceId().GetIndex()));
+    }
+    if (constraints.GetSourceChangeTime().IsSpecified())
+    {
+        statement.BindInt(8, constraints.GetSourceChangeTime());
+    }
+    if (constraints.GetHashAlgorithm().IsSpecified())
+    {
+        statement.BindString(9, constraints.GetHashAlgorithm().ToString());
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CRepositoryIndex::PathToDBString(const CPath& path)
+{
+    return Helpers::ReinterpretU8StringAsString(path.u8string());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CPath CRepositoryIndex::DBStringToPath(const std::string& string)
+{
+    return Helpers::ReinterpretStringAsU8String(string);
+}
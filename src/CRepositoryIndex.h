@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "CSqliteWrapper.h"
+#include "CRepoFile.h"
+#include "CSnapshot.h"
+
+// consolidated copy of the catalogs of all finished snapshots of a repository, so a lookup is a
+// single query instead of one per snapshot. The index is a cache, a snapshot is imported again
+// whenever size or modification time of its catalog differ from the ones recorded on import
+class CRepositoryIndex
+{
+public:
+    CRepositoryIndex(const CPath& repositoryPath, const CPath& indexPath);
+    ~CRepositoryIndex();
+
+    // imports new and changed snapshots and drops the ones not existing anymore. Snapshots existing
+    // but not given are kept and excluded from lookups, snapshots in progress are not imported
+    void Synchronize(const std::vector<std::shared_ptr<CSnapshot>>& snapshots);
+
+    bool IsIndexed(const CSnapshot& snapshot) const;
+
+    // excluded snapshots stay in the index but are skipped by FindFile
+    void Exclude(const CSnapshot& snapshot);
+    void Include(const CSnapshot& snapshot);
+
+    // searches newest to oldest snapshot like CRepository::FindFile
+    CRepoFile FindFile(const CRepoFile& constraints, bool preferLinkable) const;
+
+    // excluded snapshots are not skipped, a size wrongly reported as known only costs a hash
+    bool IsSizeKnown(CSize size) const;
+
+private:
+    struct SStamp
+    {
+        long long mSize = 0;
+        long long mTime = 0;
+
+        bool operator == (const SStamp& other) const = default;
+    };
+
+    static SStamp StaticGetStamp(const CSnapshot& snapshot);
+
+    void DBInit();
+    // returns false if no id is left between the ids of the snapshots named before and after it
+    bool DBImport(CSnapshot& snapshot, const SStamp& stamp);
+    void DBRemove(long long snapshotId);
+
+    std::string DBFormatConstraints(const CRepoFile& constraints) const;
+    void        DBBindConstraints(CSqliteWrapper::CStatement& statement, const CRepoFile& constraints) const;
+
+    static std::string PathToDBString(const CPath& path);
+    static CPath       DBStringToPath(const std::string& path);
+
+    CPath                                       mRepositoryPath;
+    CPath                                       mIndexPath;
+    mutable CSqliteWrapper                      mSqliteDB;
+    std::unordered_map<std::string, long long>  mSnapshotIds;
+    std::unordered_set<long long>               mExcludedSnapshotIds;
+
+    // the index is rebuilt from scratch if its format differs
+    inline static const int         DB_FORMAT_VERSION       = 3;
+
+    // snapshot ids ascend with the snapshot names, spaced for snapshots added out of order
+    inline static const long long   SNAPSHOT_ID_SPACING     = 1 << 20;
+};
@@ -0,0 +1,541 @@
+#include "CSha256.h"
+
+#include <cstring>
+#include <algorithm>
+#include <memory>
+
+#include "Helpers.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#   define SHA256_X86
+#   ifdef _MSC_VER
+#       define TARGET_SHA_NI
+#       define TARGET_AVX2
+#   else
+#       define TARGET_SHA_NI __attribute__((target("sha,sse4.1,ssse3")))
+#       define TARGET_AVX2 __attribute__((target("avx2")))
+#   endif
+#   include <immintrin.h>
+#endif
+
+using CompressFunction = void (*)(uint32_t* state, const unsigned char* blocks, size_t blockCount);
+
+using HashBatchFunction = void (*)(const std::vector<std::vector<unsigned char>>& messages, std::vector<CHash>& digests);
+
+struct CImplementation
+{
+    const char*         mName;
+    CompressFunction    mCompress;
+    const char*         mBatchName;
+    HashBatchFunction   mHashBatch;
+};
+
+alignas(16) static const uint32_t K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t INITIAL_STATE[8] =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static inline uint32_t RotateRight(uint32_t value, int count)
+{
+    return (value >> count) | (value << (32 - count));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static CHash StateToHash(const uint32_t* state)
+{
+    unsigned char bytes[CSha256::DIGEST_SIZE];
+    for (size_t i = 0; i < CSha256::DIGEST_SIZE; i++)
+    {
+        bytes[i] = static_cast<unsigned char>(state[i / 4] >> (24 - 8 * (i % 4)));
+    }
+    return bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void CompressPortable(uint32_t* state, const unsigned char* blocks, size_t blockCount)
+{
+    for (; blockCount > 0; blockCount--, blocks += CSha256::BLOCK_SIZE)
+    {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+        {
+            w[i] = (uint32_t(blocks[4 * i]) << 24) | (uint32_t(blocks[4 * i + 1]) << 16)
+                 | (uint32_t(blocks[4 * i + 2]) << 8) | uint32_t(blocks[4 * i + 3]);
+        }
+        for (int i = 16; i < 64; i++)
+        {
+            uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+        uint32_t f = state[5];
+        uint32_t g = state[6];
+        uint32_t h = state[7];
+
+        for (int i = 0; i < 64; i++)
+        {
+            uint32_t t1 = h + (RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void HashBatchSequential(const std::vector<std::vector<unsigned char>>& messages, std::vector<CHash>& digests)
+{
+    CSha256 sha;
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        sha.Update(messages[i].data(), messages[i].size());
+        digests[i] = sha.Finalize();
+    }
+}
+
+// one message being fed block by block into a simd lane
+struct CLaneMessage
+{
+    const unsigned char*    mData       = nullptr;
+    size_t                  mDataBlocks = 0;
+    size_t                  mBlockCount = 0;
+    size_t                  mNextBlock  = 0;
+    unsigned char           mTail[2 * CSha256::BLOCK_SIZE];
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    void Assign(const std::vector<unsigned char>& message)
+    {
+        size_t size = message.size();
+        size_t rest = size % CSha256::BLOCK_SIZE;
+
+        mData       = message.data();
+        mDataBlocks = size / CSha256::BLOCK_SIZE;
+        mNextBlock  = 0;
+
+        // the partial last block, the 0x80 marker and the bit count take one or two padding blocks
+        size_t tailSize = rest + 1 + 8 > CSha256::BLOCK_SIZE ? 2 * CSha256::BLOCK_SIZE : CSha256::BLOCK_SIZE;
+        std::memset(mTail, 0, tailSize);
+        if (rest > 0)
+        {
+            std::memcpy(mTail, mData + mDataBlocks * CSha256::BLOCK_SIZE, rest);
+        }
+        mTail[rest] = 0x80;
+        uint64_t bitCount = static_cast<uint64_t>(size) * 8;
+        for (int i = 0; i < 8; i++)
+        {
+            mTail[tailSize - 1 - i] = static_cast<unsigned char>(bitCount >> (8 * i));
+        }
+
+        mBlockCount = mDataBlocks + tailSize / CSha256::BLOCK_SIZE;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    const unsigned char* GetNextBlock() const
+    {
+        return mNextBlock < mDataBlocks
+            ? mData + mNextBlock * CSha256::BLOCK_SIZE
+            : mTail + (mNextBlock - mDataBlocks) * CSha256::BLOCK_SIZE;
+    }
+};
+
+#ifdef SHA256_X86
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+TARGET_SHA_NI static void CompressShaNi(uint32_t* state, const unsigned char* blocks, size_t blockCount)
+{
+    const __m128i byteSwapMask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // the sha instructions expect the state words in ABEF / CDGH order
+    __m128i tmp     = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xB1);
+    __m128i state1  = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1B);
+    __m128i state0  = _mm_alignr_epi8(tmp, state1, 8);
+    state1          = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; blockCount > 0; blockCount--, blocks += CSha256::BLOCK_SIZE)
+    {
+        const __m128i abefSave = state0;
+        const __m128i cdghSave = state1;
+
+        __m128i msg[4];
+        for (int group = 0; group < 16; group++)
+        {
+            __m128i& current = msg[group & 3];
+            if (group < 4)
+            {
+                current = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * group)), byteSwapMask);
+            }
+            else
+            {
+                // W[t] = W[t-16] + s0(W[t-15]) + W[t-7] + s1(W[t-2]), four words at a time
+                current = _mm_sha256msg2_epu32(
+                    _mm_add_epi32(
+                        _mm_sha256msg1_epu32(current, msg[(group + 1) & 3]),
+                        _mm_alignr_epi8(msg[(group + 3) & 3], msg[(group + 2) & 3], 4)),
+                    msg[(group + 3) & 3]);
+            }
+
+            __m128i roundInput = _mm_add_epi32(current, _mm_load_si128(reinterpret_cast<const __m128i*>(&K[4 * group])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, roundInput);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(roundInput, 0x0E));
+        }
+
+        state0 = _mm_add_epi32(state0, abefSave);
+        state1 = _mm_add_epi32(state1, cdghSave);
+    }
+
+    tmp     = _mm_shuffle_epi32(state0, 0x1B);
+    state1  = _mm_shuffle_epi32(state1, 0xB1);
+    state0  = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1  = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+
+static constexpr size_t AVX2_LANES = 8;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+template<int COUNT>
+TARGET_AVX2 static inline __m256i RotateRightAvx2(__m256i value)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(value, COUNT), _mm256_slli_epi32(value, 32 - COUNT));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+TARGET_AVX2 static void CompressLanesAvx2(__m256i* state, const unsigned char* const* blocks)
+{
+    // word i of all eight blocks, one block per lane
+    const __m256i byteSwapMask = _mm256_set_epi64x(
+        0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL, 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m256i w[16];
+    for (int i = 0; i < 16; i++)
+    {
+        uint32_t words[AVX2_LANES];
+        for (size_t lane = 0; lane < AVX2_LANES; lane++)
+        {
+            std::memcpy(&words[lane], blocks[lane] + 4 * i, 4);
+        }
+        w[i] = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(words)), byteSwapMask);
+    }
+
+    __m256i a = state[0];
+    __m256i b = state[1];
+    __m256i c = state[2];
+    __m256i d = state[3];
+    __m256i e = state[4];
+    __m256i f = state[5];
+    __m256i g = state[6];
+    __m256i h = state[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+        if (i >= 16)
+        {
+            __m256i w15 = w[(i + 1) & 15];
+            __m256i w2  = w[(i + 14) & 15];
+            __m256i s0  = _mm256_xor_si256(_mm256_xor_si256(RotateRightAvx2<7>(w15), RotateRightAvx2<18>(w15)), _mm256_srli_epi32(w15, 3));
+            __m256i s1  = _mm256_xor_si256(_mm256_xor_si256(RotateRightAvx2<17>(w2), RotateRightAvx2<19>(w2)), _mm256_srli_epi32(w2, 10));
+            w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0), _mm256_add_epi32(w[(i + 9) & 15], s1));
+        }
+
+        __m256i s1  = _mm256_xor_si256(_mm256_xor_si256(RotateRightAvx2<6>(e), RotateRightAvx2<11>(e)), RotateRightAvx2<25>(e));
+        __m256i ch  = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i t1  = _mm256_add_epi32(_mm256_add_epi32(h, s1), _mm256_add_epi32(ch, _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(K[i])), w[i & 15])));
+        __m256i s0  = _mm256_xor_si256(_mm256_xor_si256(RotateRightAvx2<2>(a), RotateRightAvx2<13>(a)), RotateRightAvx2<22>(a));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        __m256i t2  = _mm256_add_epi32(s0, maj);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, t2);
+    }
+
+    state[0] = _mm256_add_epi32(state[0], a);
+    state[1] = _mm256_add_epi32(state[1], b);
+    state[2] = _mm256_add_epi32(state[2], c);
+    state[3] = _mm256_add_epi32(state[3], d);
+    state[4] = _mm256_add_epi32(state[4], e);
+    state[5] = _mm256_add_epi32(state[5], f);
+    state[6] = _mm256_add_epi32(state[6], g);
+    state[7] = _mm256_add_epi32(state[7], h);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+TARGET_AVX2 static void HashBatchAvx2(const std::vector<std::vector<unsigned char>>& messages, std::vector<CHash>& digests)
+{
+    // state word j of all lanes lives in one register, lane l at position l
+    alignas(32) uint32_t state[8][AVX2_LANES];
+    __m256i laneState[8];
+
+    std::unique_ptr<CLaneMessage[]> lanes(new CLaneMessage[AVX2_LANES]);
+    size_t laneMessage[AVX2_LANES];
+    size_t nextMessage = 0;
+    size_t activeLanes = 0;
+
+    static const unsigned char IDLE_BLOCK[CSha256::BLOCK_SIZE] = {};
+    const unsigned char* blocks[AVX2_LANES];
+
+    for (size_t lane = 0; lane < AVX2_LANES; lane++)
+    {
+        laneMessage[lane] = messages.size();
+        for (int j = 0; j < 8; j++)
+        {
+            state[j][lane] = INITIAL_STATE[j];
+        }
+        if (nextMessage < messages.size())
+        {
+            lanes[lane].Assign(messages[nextMessage]);
+            laneMessage[lane] = nextMessage++;
+            activeLanes++;
+        }
+    }
+    for (int j = 0; j < 8; j++)
+    {
+        laneState[j] = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[j]));
+    }
+
+    while (activeLanes > 0)
+    {
+        for (size_t lane = 0; lane < AVX2_LANES; lane++)
+        {
+            blocks[lane] = laneMessage[lane] < messages.size() ? lanes[lane].GetNextBlock() : IDLE_BLOCK;
+        }
+
+        CompressLanesAvx2(laneState, blocks);
+
+        // a lane whose message is complete is handed its digest and refilled with the next message
+        bool refilled = false;
+        for (size_t lane = 0; lane < AVX2_LANES; lane++)
+        {
+            if (laneMessage[lane] >= messages.size() || ++lanes[lane].mNextBlock < lanes[lane].mBlockCount)
+            {
+                continue;
+            }
+
+            if (!refilled)
+            {
+                for (int j = 0; j < 8; j++)
+                {
+                    _mm256_store_si256(reinterpret_cast<__m256i*>(state[j]), laneState[j]);
+                }
+                refilled = true;
+            }
+
+            uint32_t digestState[8];
+            for (int j = 0; j < 8; j++)
+            {
+                digestState[j] = state[j][lane];
+                state[j][lane] = INITIAL_STATE[j];
+            }
+            digests[laneMessage[lane]] = StateToHash(digestState);
+
+            if (nextMessage < messages.size())
+            {
+                lanes[lane].Assign(messages[nextMessage]);
+                laneMessage[lane] = nextMessage++;
+            }
+            else
+            {
+                laneMessage[lane] = messages.size();
+                activeLanes--;
+            }
+        }
+
+        if (refilled)
+        {
+            for (int j = 0; j < 8; j++)
+            {
+                laneState[j] = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[j]));
+            }
+        }
+    }
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static CImplementation SelectImplementation()
+{
+    CImplementation implementation = { "portable", CompressPortable, "sequential", HashBatchSequential };
+#ifdef SHA256_X86
+    if (Helpers::CpuSupportsShaNi())
+    {
+        implementation.mName        = "SHA-NI";
+        implementation.mCompress    = CompressShaNi;
+    }
+    else if (Helpers::CpuSupportsAvx2())
+    {
+        // a single sha-ni stream outruns eight avx2 lanes, multi-buffer only pays off without it
+        implementation.mBatchName   = "AVX2 x8";
+        implementation.mHashBatch   = HashBatchAvx2;
+    }
+#endif
+    return implementation;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static const CImplementation& GetImplementation()
+{
+    // selected once, based on the features of the executing cpu
+    static const CImplementation sImplementation = SelectImplementation();
+    return sImplementation;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CSha256::StaticGetImplementationName()
+{
+    return GetImplementation().mName;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CSha256::StaticGetBatchImplementationName()
+{
+    return GetImplementation().mBatchName;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::vector<CHash> CSha256::StaticHashBatch(const std::vector<std::vector<unsigned char>>& messages)
+{
+    std::vector<CHash> digests(messages.size());
+    GetImplementation().mHashBatch(messages, digests);
+    return digests;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSha256::CSha256()
+{
+    Reset();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSha256::Reset()
+{
+    std::memcpy(mState, INITIAL_STATE, sizeof(mState));
+    mBufferSize = 0;
+    mTotalSize  = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSha256::Update(const void* data, size_t size)
+{
+    const unsigned char* input = static_cast<const unsigned char*>(data);
+    CompressFunction compress = GetImplementation().mCompress;
+
+    mTotalSize += size;
+
+    if (mBufferSize > 0)
+    {
+        size_t fill = std::min(size, BLOCK_SIZE - mBufferSize);
+        std::memcpy(mBuffer + mBufferSize, input, fill);
+        mBufferSize += fill;
+        input       += fill;
+        size        -= fill;
+
+        if (mBufferSize < BLOCK_SIZE)
+        {
+            return;
+        }
+        compress(mState, mBuffer, 1);
+        mBufferSize = 0;
+    }
+
+    size_t blockCount = size / BLOCK_SIZE;
+    if (blockCount > 0)
+    {
+        compress(mState, input, blockCount);
+        input   += blockCount * BLOCK_SIZE;
+        size    -= blockCount * BLOCK_SIZE;
+    }
+
+    std::memcpy(mBuffer, input, size);
+    mBufferSize = size;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CHash CSha256::Finalize()
+{
+    CompressFunction compress = GetImplementation().mCompress;
+
+    uint64_t bitCount = mTotalSize * 8;
+
+    mBuffer[mBufferSize++] = 0x80;
+    if (mBufferSize > BLOCK_SIZE - 8)
+    {
+        std::memset(mBuffer + mBufferSize, 0, BLOCK_SIZE - mBufferSize);
+        compress(mState, mBuffer, 1);
+        mBufferSize = 0;
+    }
+    std::memset(mBuffer + mBufferSize, 0, BLOCK_SIZE - 8 - mBufferSize);
+    for (int i = 0; i < 8; i++)
+    {
+        mBuffer[BLOCK_SIZE - 1 - i] = static_cast<unsigned char>(bitCount >> (8 * i));
+    }
+    compress(mState, mBuffer, 1);
+
+    CHash result = StateToHash(mState);
+
+    Reset();
+
+    return result;
+}
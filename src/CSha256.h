@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "CHash.h"
+
+class CSha256
+{
+public:
+    static constexpr size_t BLOCK_SIZE  = 64;
+    static constexpr size_t DIGEST_SIZE = 32;
+
+public: // static
+    static std::string StaticGetImplementationName();
+    static std::string StaticGetBatchImplementationName();
+
+    // hashes independent messages side by side in simd lanes, returns the digests in the same order
+    static std::vector<CHash> StaticHashBatch(const std::vector<std::vector<unsigned char>>& messages);
+
+public:
+    CSha256();
+
+    void        Reset();
+    void        Update(const void* data, size_t size);
+    CHash       Finalize();
+
+private:
+    uint32_t        mState[8];
+    unsigned char   mBuffer[BLOCK_SIZE];
+    size_t          mBufferSize;
+    uint64_t        mTotalSize;
+};
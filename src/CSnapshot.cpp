@@ -1,24 +1,49 @@
 #include "CSnapshot.h"
 
 #include <filesystem>
+#include <algorithm>
 
 #include "CLogger.h"
 #include "Helpers.h"
 
-static constexpr bool DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE = true;
+static constexpr bool DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME_FILEDEVICE_FILEINODE = true;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-CSnapshot::CIterator::CIterator(CSqliteWrapper::CStatement&& statement, const CPath& parentPath)
+CSnapshot::CIterator::CIterator(CSqliteWrapper::CStatement&& statement, const CSnapshot& snapshot)
     :
-    mParentPath(parentPath),
+    mSnapshot(&snapshot),
     mStatement(std::move(statement))
 {}
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSnapshot::CIterator::CIterator(const CManifest& manifest, const CSnapshot& snapshot)
+    :
+    mSnapshot(&snapshot),
+    mStatement(nullptr),
+    mManifest(&manifest),
+    mIsScan(true)
+{}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSnapshot::CIterator::CIterator(const CManifest& manifest, std::vector<size_t>&& indices, const CSnapshot& snapshot)
+    :
+    mSnapshot(&snapshot),
+    mStatement(nullptr),
+    mManifest(&manifest),
+    mIndices(std::move(indices))
+{}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 bool CSnapshot::CIterator::HasFile()
 {
+    if (mManifest)
+    {
+        return mPosition < (mIsScan ? mManifest->GetFileCount() : mIndices.size());
+    }
     return mStatement.HasData();
 }
 
@@ -26,16 +51,122 @@ bool CSnapshot::CIterator::HasFile()
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 CRepoFile CSnapshot::CIterator::GetNextFile()
 {
-    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE, "TODO");
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME_FILEDEVICE_FILEINODE, "TODO");
 
-    return
+    if (mManifest)
+    {
+        return ReadNextFile();
+    }
+
+    CRepoFile file
     {
-        DBStringToPath(mStatement.ReadString(0)),
+        ReadPath(8, 0),
         mStatement.ReadInt(1),
         mStatement.ReadInt(2),
-        mStatement.ReadString(3),
-        DBStringToPath(mStatement.ReadString(4)),
-        mParentPath
+        ReadHash(3),
+        ReadPath(9, 4),
+        mSnapshot->mPath,
+        mSnapshot->mHashAlgorithm,
+        ReadFileId(5, 6),
+        mStatement.IsNull(7) ? CTime() : CTime(mStatement.ReadInt(7))
+    };
+    file.SetFileId(ReadFileId(10, 11));
+
+    return file;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CRepoFile& CSnapshot::CIterator::ReadNextFile()
+{
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME_FILEDEVICE_FILEINODE, "TODO");
+
+    if (mManifest)
+    {
+        mManifest->ReadFile(mIsScan ? mPosition : mIndices[mPosition], mFile, mPath);
+        mPosition++;
+        mFile.SetParentPath(mSnapshot->mPath);
+        mFile.SetHashAlgorithm(mSnapshot->mHashAlgorithm);
+        return mFile;
+    }
+
+    ReadPath(8, 0, mPath);
+    mFile.SetSourcePath(mPath);
+    mFile.SetSize(mStatement.ReadInt(1));
+    mFile.SetTime(mStatement.ReadInt(2));
+    mFile.SetHash(ReadHash(3));
+    ReadPath(9, 4, mPath);
+    mFile.SetRelativePath(mPath);
+    mFile.SetParentPath(mSnapshot->mPath);
+    mFile.SetHashAlgorithm(mSnapshot->mHashAlgorithm);
+    mFile.SetSourceId(ReadFileId(5, 6));
+    mFile.SetSourceChangeTime(mStatement.IsNull(7) ? CTime() : CTime(mStatement.ReadInt(7)));
+    mFile.SetFileId(ReadFileId(10, 11));
+
+    return mFile;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CHash CSnapshot::CIterator::ReadHash(int col)
+{
+    if (!mStatement.IsBlob(col))
+    {
+        return CHash::StaticFromHex(mStatement.ReadString(col));
+    }
+
+    size_t size = 0;
+    const unsigned char* bytes = mStatement.ReadBlob(col, size);
+    if (size != CHash::SIZE)
+    {
+        throw "invalid hash size in snapshot: " + mSnapshot->mPath.string();
+    }
+    return bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CPath CSnapshot::CIterator::ReadPath(int directoryCol, int nameCol)
+{
+    // catalogs before version 4 store the whole path
+    if (mStatement.IsNull(directoryCol))
+    {
+        return DBStringToPath(mStatement.ReadString(nameCol));
+    }
+
+    return mSnapshot->DBGetDirectoryPath(mStatement.ReadInt(directoryCol)) / DBStringToPath(mStatement.ReadString(nameCol));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::CIterator::ReadPath(int directoryCol, int nameCol, CPath& path)
+{
+    std::string_view name = mStatement.ReadStringView(nameCol);
+    std::u8string_view u8Name(reinterpret_cast<const char8_t*>(name.data()), name.size());
+
+    if (mStatement.IsNull(directoryCol))
+    {
+        path.assign(u8Name);
+        return;
+    }
+
+    path = mSnapshot->DBGetDirectoryPath(mStatement.ReadInt(directoryCol));
+    path.append(u8Name);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CFileId CSnapshot::CIterator::ReadFileId(int deviceCol, int indexCol)
+{
+    if (mStatement.IsNull(deviceCol) || mStatement.IsNull(indexCol))
+    {
+        return {};
+    }
+
+    return
+    {
+        static_cast<unsigned long long>(mStatement.ReadInt(deviceCol)),
+        static_cast<unsigned long long>(mStatement.ReadInt(indexCol))
     };
 }
 
@@ -46,6 +177,98 @@ CRepoFile CSnapshot::CIterator::GetNextFile()
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSnapshot::CCursor::CCursor(const CSnapshot& snapshot)
+    :
+    mSnapshot(&snapshot)
+{}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const std::vector<CRepoFile>& CSnapshot::CCursor::FindBySource(const CPath& sourcePath)
+{
+    mSnapshot->DBForReading();
+    if (mSnapshot->mFormatVersion >= 4)
+    {
+        return FindBySourceInDirectory(sourcePath);
+    }
+
+    std::string source = PathToDBString(sourcePath);
+    if (mIsStarted && source == mSource)
+    {
+        return mFiles;
+    }
+
+    if (!mIsStarted || source < mSource)
+    {
+        mNextFile.reset();
+        mIterator.emplace(mSnapshot->DBSelectFromSource(sourcePath));
+        mIsExhausted    = false;
+        mIsStarted      = true;
+    }
+
+    mSource = source;
+    mFiles.clear();
+
+    // files of smaller source paths were not searched for, they are skipped
+    while (true)
+    {
+        if (!mNextFile)
+        {
+            // a finished statement must not be stepped again, it would restart
+            if (mIsExhausted || !mIterator->HasFile())
+            {
+                mIsExhausted = true;
+                break;
+            }
+            mNextFile = mIterator->GetNextFile();
+        }
+
+        std::string nextSource = PathToDBString(mNextFile->GetSourcePath());
+        if (nextSource > source)
+        {
+            break;
+        }
+        if (nextSource == source)
+        {
+            mFiles.push_back(std::move(*mNextFile));
+        }
+        mNextFile.reset();
+    }
+
+    return mFiles;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const std::vector<CRepoFile>& CSnapshot::CCursor::FindBySourceInDirectory(const CPath& sourcePath)
+{
+    // the files of a directory are a single range of the index on SOURCE_DIR
+    CPath directory = sourcePath.parent_path();
+    if (!mIsStarted || directory != mDirectory)
+    {
+        mDirectoryFiles.clear();
+        auto iterator = mSnapshot->DBSelectInSourceDirectory(directory);
+        while (iterator.HasFile())
+        {
+            CRepoFile file = iterator.GetNextFile();
+            mDirectoryFiles.emplace(PathToDBString(file.GetSourcePath().filename()), std::move(file));
+        }
+        mDirectory  = directory;
+        mIsStarted  = true;
+    }
+
+    mFiles.clear();
+    auto range = mDirectoryFiles.equal_range(PathToDBString(sourcePath.filename()));
+    for (auto it = range.first; it != range.second; it++)
+    {
+        mFiles.push_back(it->second);
+    }
+
+    return mFiles;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 bool CSnapshot::StaticIsExsting(const CPath& path)
@@ -96,6 +319,26 @@ CPath CSnapshot::GetMetaDataPath() const
     return mPath / META_DATA_PATH;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CPath CSnapshot::GetDatabasePath() const
+{
+    return mPath / DB_FILE_PATH;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::Prefetch() const
+{
+    Helpers::ReadAhead(GetDatabasePath());
+    Helpers::ReadAhead(mPath / MANIFEST_FILE_PATH);
+
+    if (!mFilterLoaded)
+    {
+        LoadFilter();
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void CSnapshot::Open(const CPath& path, bool create)
@@ -120,25 +363,55 @@ void CSnapshot::Open(const CPath& path, bool create)
     else
     {
         StaticValidate(mPath);
-
-        Helpers::MakeBackup(mPath / DB_FILE_PATH);
-        Helpers::MakeWritable(mPath / DB_FILE_PATH);
+        return;
     }
 
-    DBInit();
+    DBOpen(true);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void CSnapshot::Close()
 {
+    DBStopWriter();
     if (mSqliteDB.IsOpen())
     {
-        mSqliteDB.Close();
+        DBCommit();
+        DBPersist();
+        DBClose();
+    }
+    mIsLoaded = false;
+    mWriterFailed = false;
+    mFilter.reset();
+    mFilterLoaded = false;
+    mManifest.Close();
+    mManifestLoaded = false;
+    mDirectoryPaths.clear();
+    mDirectoryIds.clear();
+    mDirectoriesLoaded = false;
+}
 
-        Helpers::MakeReadOnly(mPath / DB_FILE_PATH);
-        Helpers::MakeBackup(mPath / DB_FILE_PATH);
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CHashAlgorithm CSnapshot::GetHashAlgorithm() const
+{
+    if (!mIsLoaded)
+    {
+        DBForReading();
     }
+    return mHashAlgorithm;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::SetHashAlgorithm(CHashAlgorithm hashAlgorithm)
+{
+    VERIFY(hashAlgorithm.IsSpecified());
+
+    DBForWriting().RunQuery(
+        "insert or replace into META values ('HASH_ALGORITHM', "
+        + CSqliteWrapper::ToStringLiteral(hashAlgorithm.ToString()) + ")");
+    mHashAlgorithm = hashAlgorithm;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -151,6 +424,21 @@ void CSnapshot::SetInProgress()
     {
         throw "cannot set in progress: " + mPath.string();
     }
+
+    // a snapshot in progress is changed, its catalog is opened for writing before files are
+    // iterated, so rows can be deleted while iterating
+    DBForWriting();
+
+    // the filter and the manifest are rebuilt when finished
+    std::error_code errorCode;
+    Helpers::MakeWritable(mPath / FILTER_FILE_PATH);
+    std::filesystem::remove(mPath / FILTER_FILE_PATH, errorCode);
+    mFilter.reset();
+    mFilterLoaded = false;
+    mManifest.Close();
+    mManifestLoaded = false;
+    Helpers::MakeWritable(mPath / MANIFEST_FILE_PATH);
+    std::filesystem::remove(mPath / MANIFEST_FILE_PATH, errorCode);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -158,27 +446,178 @@ void CSnapshot::SetInProgress()
 void CSnapshot::ClearInProgress()
 {
     VERIFY(IsInProgress());
+
+    // the snapshot is complete only with all its files registered
+    DBStopWriter();
+    if (mWriterFailed)
+    {
+        throw "cannot finish snapshot, catalog writes failed: " + mPath.string();
+    }
+    DBCommit();
+    DBPersist();
+
     std::filesystem::remove(mPath / IN_PROGRESS_FILE_PATH);
     if (IsInProgress())
     {
         throw "cannot clear in progress: " + mPath.string();
     }
+
+    mFilter = BuildFilter();
+    mFilterLoaded = true;
+    if (!mFilter->Save(mPath / FILTER_FILE_PATH))
+    {
+        CLogger::GetInstance().LogWarning("cannot write filter: " + (mPath / FILTER_FILE_PATH).string());
+    }
+
+    mManifestLoaded = false;
+    if (!SaveManifest())
+    {
+        CLogger::GetInstance().LogWarning("cannot write manifest: " + (mPath / MANIFEST_FILE_PATH).string());
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-bool CSnapshot::IsInProgress()
+bool CSnapshot::IsInProgress() const
 {
     return std::filesystem::exists(mPath / IN_PROGRESS_FILE_PATH);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+int CSnapshot::GetFormatVersion() const
+{
+    if (!mIsLoaded)
+    {
+        DBForReading();
+    }
+    return mFormatVersion;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CSnapshot::IsUpgradeNeeded() const
+{
+    // the catalog of an interrupted upgrade cannot be opened for reading, see DBInit
+    if (!mSqliteDB.IsOpen())
+    {
+        CSqliteWrapper sqliteDB(GetDatabasePath(), true);
+        if (StaticHasTable(sqliteDB, "FILES_OLD"))
+        {
+            return true;
+        }
+    }
+
+    if (GetFormatVersion() != DB_FORMAT_VERSION)
+    {
+        return true;
+    }
+
+    if (IsInProgress())
+    {
+        return false;
+    }
+    if (!mFilterLoaded)
+    {
+        LoadFilter();
+    }
+    return !mFilter || !GetManifest();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::Upgrade()
+{
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME_FILEDEVICE_FILEINODE, "TODO");
+
+    VERIFY(IsInProgress());
+    VERIFY(!mWriter.joinable());
+    VERIFY(!mInMemory);
+
+    CSqliteWrapper& sqliteDB = DBForWriting();
+    if (mFormatVersion == DB_FORMAT_VERSION)
+    {
+        return;
+    }
+    DBCommit();
+
+    // a catalog can be larger than the memory of all concurrent upgrades together
+    sqliteDB.RunQuery("pragma cache_size = -" + std::to_string(DB_UPGRADE_CACHE_SIZE));
+
+    // the old rows are moved aside and copied into tables of the current format. The DIRS table of
+    // version 4 is unchanged, its directories are kept with their ids. The rows of an interrupted
+    // upgrade are aside already, the empty table created on opening is dropped instead
+    sqliteDB.RunQuery("drop index if exists FILES_SOURCE_SIZE_TIME_HASH_FILE");
+    sqliteDB.RunQuery("drop index if exists FILES_HASH");
+    sqliteDB.RunQuery("drop index if exists FILES_SOURCE_INODE");
+    if (StaticHasTable(sqliteDB, "FILES_OLD"))
+    {
+        sqliteDB.RunQuery("drop table FILES");
+    }
+    else
+    {
+        sqliteDB.RunQuery("alter table FILES rename to FILES_OLD");
+    }
+
+    {
+        // the select is prepared in the old format, rows are read independently of it
+        CIterator iterator(sqliteDB.StartQuery(DBSelectColumns("FILES_OLD")), *this);
+
+        mFormatVersion = DB_FORMAT_VERSION;
+        DBCreateTables();
+
+        while (iterator.HasFile())
+        {
+            CRepoFile& file = iterator.ReadNextFile();
+            if (!file.GetFileId().IsSpecified())
+            {
+                file.SetFileId(CFileId::StaticFromPath(file.GetFullPath()));
+            }
+            DBWriteInsert(file);
+        }
+    }
+    DBCommit();
+
+    // the catalog is in the current format only once all rows are copied
+    DBBeginWrite();
+    sqliteDB.RunQuery("drop table FILES_OLD");
+    sqliteDB.RunQuery("pragma user_version = " + std::to_string(DB_FORMAT_VERSION));
+    DBCommit();
+    DBCompact();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 CRepoFile CSnapshot::FindFile(const CRepoFile& constraints, bool preferLinkable) const
 {
     CRepoFile unlinkableFile;
 
-    auto iterator = DBSelect(constraints);
+    // the filter is checked first, it saves opening the catalog as well
+    if (!MayContain(constraints))
+    {
+        return unlinkableFile;
+    }
+    if ((constraints.GetSourceId().IsSpecified() && GetFormatVersion() < 2)
+        || (constraints.GetSourceChangeTime().IsSpecified() && GetFormatVersion() < 3))
+    {
+        return unlinkableFile;
+    }
+
+    std::vector<CRepoFile> pendingFiles;
+    if (FindPendingFiles(constraints, pendingFiles))
+    {
+        for (auto& file : pendingFiles)
+        {
+            if (!preferLinkable || file.IsLinkable())
+            {
+                return file;
+            }
+            unlinkableFile = file;
+        }
+        return unlinkableFile;
+    }
+
+    auto iterator = IterateFiles(constraints);
     while (iterator.HasFile())
     {
         CRepoFile file = iterator.GetNextFile();
@@ -199,7 +638,12 @@ std::vector<CRepoFile> CSnapshot::FindAllFiles(const CRepoFile& constraints) con
     std::vector<CRepoFile> result;
     result.reserve(1000);
 
-    auto iterator = DBSelect(constraints);
+    if (FindPendingFiles(constraints, result))
+    {
+        return result;
+    }
+
+    auto iterator = IterateFiles(constraints);
     while (iterator.HasFile())
     {
         result.emplace_back(iterator.GetNextFile());
@@ -210,102 +654,759 @@ std::vector<CRepoFile> CSnapshot::FindAllFiles(const CRepoFile& constraints) con
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-bool CSnapshot::InsertFile(const CPath& source, const CRepoFile& target, bool preferLink)
+CSnapshot::CIterator CSnapshot::IterateFiles(const CRepoFile& constraints) const
 {
-    VERIFY(!target.GetSourcePath().empty());
-    VERIFY(target.HasHash());
-    VERIFY(target.GetSize().IsSpecified());
-    VERIFY(target.GetTime().IsSpecified());
-    VERIFY(!target.GetRelativePath().empty());
-    VERIFY(target.GetParentPath() == GetAbsolutePath());
-
-    if (!(preferLink && target.Link(source)) && !target.Copy(source))
+    const CManifest* manifest = GetManifest();
+    if (manifest)
     {
-        return false;
-    }
+        // files read from the manifest take the hash algorithm from the catalog
+        GetHashAlgorithm();
 
-    DBInsert(target);
+        if (StaticIsUnconstrained(constraints))
+        {
+            return { *manifest, *this };
+        }
+        std::vector<size_t> indices;
+        if (manifest->FindFiles(constraints, indices))
+        {
+            return { *manifest, std::move(indices), *this };
+        }
+    }
 
-    return true;
+    return DBSelect(constraints);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-bool CSnapshot::DeleteFile(CRepoFile& repoFile)
+std::vector<long long> CSnapshot::FindAllSizes() const
 {
-    if (!repoFile.Delete())
+    std::vector<long long> result;
+
+    auto statement = DBForReading().StartQuery("select distinct SIZE from FILES");
+    while (statement.HasData())
     {
-        return false;
+        result.push_back(statement.ReadInt(0));
     }
 
-    DBDelete(repoFile);
-
-    return true;
+    return result;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-CSnapshot::CIterator CSnapshot::DBSelect(const CRepoFile& constraints) const
+bool CSnapshot::InsertFile(const CPath& source, const CRepoFile& target, bool preferLink)
 {
-    std::string query = "select * from FILES " + DBFormatConstraints(constraints);
+    if (!(preferLink && target.Link(source)) && !target.Copy(source))
+    {
+        return false;
+    }
 
-    return { mSqliteDB.StartQuery(query), mPath };
+    RegisterFile(target);
+
+    return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-void CSnapshot::DBInsert(const CRepoFile& file)
+void CSnapshot::RegisterFile(const CRepoFile& target)
 {
-    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE, "TODO");
-
-    mSqliteDB.RunQuery(
-        std::string("insert into FILES values (")
-        + CSqliteWrapper::ToStringLiteral(PathToDBString(file.GetSourcePath())) + ", "
-        + std::to_string(file.GetSize()) + ", "
-        + std::to_string(file.GetTime()) + ", "
-        + CSqliteWrapper::ToStringLiteral(file.GetHash()) + ", "
-        + CSqliteWrapper::ToStringLiteral(PathToDBString(file.GetRelativePath()))
-        + ")");
+    VERIFY(!target.GetSourcePath().empty());
+    VERIFY(target.HasHash());
+    VERIFY(target.GetSize().IsSpecified());
+    VERIFY(target.GetTime().IsSpecified());
+    VERIFY(!target.GetRelativePath().empty());
+    VERIFY(target.GetParentPath() == GetAbsolutePath());
+    VERIFY(target.GetHashAlgorithm() == GetHashAlgorithm());
+
+    // recorded once here, so verify does not have to query every backup file
+    if (!target.GetFileId().IsSpecified() && mFormatVersion >= 6)
+    {
+        CRepoFile file = target;
+        file.SetFileId(CFileId::StaticFromPath(file.GetFullPath()));
+        DBInsert(file);
+        return;
+    }
+
+    DBInsert(target);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CSnapshot::DeleteFile(CRepoFile& repoFile)
+{
+    if (!repoFile.Delete())
+    {
+        return false;
+    }
+
+    DBDelete(repoFile);
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSnapshot::CIterator CSnapshot::DBSelect(const CRepoFile& constraints) const
+{
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME_FILEDEVICE_FILEINODE, "TODO");
+
+    auto& sqliteDB = DBForReading();
+    auto statement = sqliteDB.StartCachedQuery(DBSelectColumns() + DBFormatConstraints(constraints));
+    DBBindConstraints(statement, constraints);
+
+    return { std::move(statement), *this };
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSnapshot::CIterator CSnapshot::DBSelectFromSource(const CPath& sourcePath) const
+{
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME_FILEDEVICE_FILEINODE, "TODO");
+
+    auto& sqliteDB = DBForReading();
+    VERIFY(mFormatVersion < 4);
+
+    // walks the index on SOURCE, sqlite compares text byte-wise
+    auto statement = sqliteDB.StartCachedQuery(DBSelectColumns() + " where SOURCE >= ?1 order by SOURCE");
+    statement.BindString(1, PathToDBString(sourcePath));
+
+    return { std::move(statement), *this };
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSnapshot::CIterator CSnapshot::DBSelectInSourceDirectory(const CPath& directoryPath) const
+{
+    auto& sqliteDB = DBForReading();
+    VERIFY(mFormatVersion >= 4);
+
+    auto statement = sqliteDB.StartCachedQuery(DBSelectColumns() + " where SOURCE_DIR = ?1");
+    statement.BindInt(1, DBFindDirectory(directoryPath));
+
+    return { std::move(statement), *this };
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBInsert(const CRepoFile& file)
+{
+    if (!mWriter.joinable())
+    {
+        DBWriteInsert(file);
+        return;
+    }
+
+    std::vector<std::string> keys = StaticGetFilterKeys(file);
+
+    std::unique_lock<std::mutex> lock(mWriterMutex);
+    mWriterProgress.wait(lock, [this]() { return mWriterQueue.size() < DB_WRITER_QUEUE_SIZE || mWriterException; });
+    if (mWriterException)
+    {
+        std::exception_ptr exception = mWriterException;
+        mWriterException = nullptr;
+        std::rethrow_exception(exception);
+    }
+
+    // the queued row keeps its address when the writer takes the queue over
+    mWriterQueue.push_back(file);
+    for (auto& key : keys)
+    {
+        mWriterPending.emplace(std::move(key), &mWriterQueue.back());
+    }
+    lock.unlock();
+    mWriterWakeUp.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBWriteInsert(const CRepoFile& file)
+{
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME_FILEDEVICE_FILEINODE, "TODO");
+
+    DBBeginWrite();
+
+    // parameters are numbered as in DBFormatConstraints
+    auto statement = DBForWriting().StartCachedQuery(
+        mFormatVersion < 2 ? "insert into FILES values (?, ?, ?, ?, ?)" :
+        mFormatVersion < 3 ? "insert into FILES values (?, ?, ?, ?, ?, ?, ?)" :
+        mFormatVersion < 4 ? "insert into FILES values (?, ?, ?, ?, ?, ?, ?, ?)" :
+        mFormatVersion < 6 ? "insert into FILES values (?1, ?9, ?2, ?3, ?4, ?5, ?10, ?6, ?7, ?8)" :
+                             "insert into FILES values (?1, ?9, ?2, ?3, ?4, ?5, ?10, ?6, ?7, ?8, ?11, ?12)");
+
+    if (mFormatVersion < 4)
+    {
+        statement.BindString(1, PathToDBString(file.GetSourcePath()));
+        statement.BindString(5, PathToDBString(file.GetRelativePath()));
+    }
+    else
+    {
+        statement.BindInt(1, DBInsertDirectory(file.GetSourcePath().parent_path()));
+        statement.BindString(9, PathToDBString(file.GetSourcePath().filename()));
+        statement.BindInt(5, DBInsertDirectory(file.GetRelativePath().parent_path()));
+        statement.BindString(10, PathToDBString(file.GetRelativePath().filename()));
+    }
+    statement.BindInt(2, file.GetSize());
+    statement.BindInt(3, file.GetTime());
+    DBBindHash(statement, 4, file.GetHash());
+    if (mFormatVersion >= 2)
+    {
+        DBBindFileId(statement, 6, 7, file.GetSourceId());
+    }
+    if (mFormatVersion >= 3)
+    {
+        if (file.GetSourceChangeTime().IsSpecified())
+        {
+            statement.BindInt(8, file.GetSourceChangeTime());
+        }
+        else
+        {
+            statement.BindNull(8);
+        }
+    }
+    if (mFormatVersion >= 6)
+    {
+        DBBindFileId(statement, 11, 12, file.GetFileId());
+    }
+
+    statement.Execute();
+    statement.Finalize();
+
+    DBEndWrite();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::CSnapshot::DBDelete(const CRepoFile& constraints)
+{
+    DBBeginWrite();
+
+    auto statement = DBForWriting().StartCachedQuery("delete from FILES" + DBFormatConstraints(constraints));
+    DBBindConstraints(statement, constraints);
+    statement.Execute();
+    statement.Finalize();
+
+    DBEndWrite();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CSnapshot::CSnapshot::DBCheckIntegrity()
+{
+    auto statement = DBForReading().StartQuery("pragma integrity_check");
+    VERIFY(statement.HasData());
+    return statement.ReadString(0) == "ok";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::CSnapshot::DBCompact()
+{
+    // vacuum cannot run within a transaction
+    DBCommit();
+    DBForWriting().RunQuery("vacuum");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBCommit()
+{
+    DBFlush();
+
+    if (mInTransaction)
+    {
+        mSqliteDB.RunQuery("commit");
+        mInTransaction = false;
+        mPendingWrites = 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBBeginWrite()
+{
+    if (!mInTransaction)
+    {
+        DBForWriting().RunQuery("begin");
+        mInTransaction      = true;
+        mTransactionStart   = std::chrono::steady_clock::now();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBEndWrite()
+{
+    mPendingWrites++;
+
+    if (mPendingWrites >= DB_TRANSACTION_MAX_WRITES
+        || std::chrono::steady_clock::now() - mTransactionStart >= DB_TRANSACTION_MAX_DURATION)
+    {
+        DBCommit();
+
+        // a catalog outgrowing its memory is moved to its file and continued there
+        if (mInMemory && DBGetSize() > mMemoryLimit)
+        {
+            CLogger::GetInstance().Log("catalog exceeds memory limit, writing it to: " + (mPath / DB_FILE_PATH).string());
+            DBPersist();
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSqliteWrapper& CSnapshot::DBForReading() const
+{
+    DBFlush();
+
+    if (!mSqliteDB.IsOpen())
+    {
+        DBOpen(false);
+    }
+    if (mIsWritable)
+    {
+        return mSqliteDB;
+    }
+
+    sOpenReadOnly.splice(sOpenReadOnly.end(), sOpenReadOnly, mOpenReadOnlyPosition);
+
+    // catalogs with statements in progress stay open, even beyond the limit
+    auto it = sOpenReadOnly.begin();
+    while (sOpenReadOnly.size() > DB_MAX_OPEN_READ_ONLY && *it != this)
+    {
+        const CSnapshot* snapshot = *it++;
+        if (!snapshot->mSqliteDB.IsInUse())
+        {
+            snapshot->DBClose();
+        }
+    }
+
+    return mSqliteDB;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSqliteWrapper& CSnapshot::DBForWriting()
+{
+    DBFlush();
+
+    if (mSqliteDB.IsOpen() && !mIsWritable)
+    {
+        VERIFY(!mSqliteDB.IsInUse());
+        DBClose();
+    }
+    if (!mSqliteDB.IsOpen())
+    {
+        DBOpen(true);
+    }
+
+    return mSqliteDB;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::StartWriter()
+{
+    VERIFY(!mWriter.joinable());
+    VERIFY(mIsWritable);
+
+    // with rows already in the catalog, every search has to read it
+    mWriterStartedEmpty = DBCountFiles() == 0;
+    mWriterStopping = false;
+    mWriter = std::thread([this]() { WriterLoop(); });
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::WriterLoop()
+{
+    std::unique_lock<std::mutex> lock(mWriterMutex);
+    while (true)
+    {
+        mWriterWakeUp.wait(lock, [this]() { return mWriterStopping || !mWriterQueue.empty(); });
+        if (mWriterQueue.empty())
+        {
+            return;
+        }
+
+        // the queue is taken as a whole, the producer can refill it meanwhile
+        std::deque<CRepoFile> files;
+        files.swap(mWriterQueue);
+        mWriterBusy = true;
+        lock.unlock();
+        mWriterProgress.notify_all();
+
+        std::exception_ptr exception;
+        std::vector<std::vector<std::string>> keys;
+        keys.reserve(files.size());
+        try
+        {
+            // after a failure the rows are dropped, the snapshot cannot be finished anymore
+            for (auto& file : files)
+            {
+                if (!mWriterFailed)
+                {
+                    DBWriteInsert(file);
+                }
+                keys.push_back(StaticGetFilterKeys(file));
+            }
+        }
+        catch (...)
+        {
+            exception = std::current_exception();
+        }
+
+        // the written rows move from the pending ones to the filters, a failure fails lookups
+        // anyway, through DBFlush
+        lock.lock();
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            for (auto& key : keys[i])
+            {
+                if (mWriterFilterKeys == mWriterFilterCapacity)
+                {
+                    mWriterFilterCapacity = std::max(DB_WRITER_FILTER_SIZE, 2 * mWriterFilterCapacity);
+                    mWriterFilters.emplace_back(mWriterFilterCapacity - mWriterFilterKeys);
+                }
+                mWriterFilters.back().Add(key);
+                mWriterFilterKeys++;
+
+                auto range = mWriterPending.equal_range(key);
+                for (auto it = range.first; it != range.second; it++)
+                {
+                    if (it->second == &files[i])
+                    {
+                        mWriterPending.erase(it);
+                        break;
+                    }
+                }
+            }
+        }
+        if (exception)
+        {
+            mWriterException    = exception;
+            mWriterFailed       = true;
+        }
+        mWriterBusy = false;
+        mWriterProgress.notify_all();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBFlush() const
+{
+    // the writer thread itself reaches here through its own catalog accesses
+    if (!mWriter.joinable() || std::this_thread::get_id() == mWriter.get_id())
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mWriterMutex);
+    mWriterProgress.wait(lock, [this]() { return mWriterQueue.empty() && !mWriterBusy; });
+    if (mWriterException)
+    {
+        std::exception_ptr exception = mWriterException;
+        mWriterException = nullptr;
+        std::rethrow_exception(exception);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBStopWriter()
+{
+    if (!mWriter.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mWriterMutex);
+        mWriterStopping = true;
+    }
+    mWriterWakeUp.notify_one();
+    mWriter.join();
+
+    mWriterPending.clear();
+    mWriterFilters.clear();
+    mWriterFilterKeys       = 0;
+    mWriterFilterCapacity   = 0;
+
+    if (mWriterException)
+    {
+        std::exception_ptr exception = mWriterException;
+        mWriterException = nullptr;
+        std::rethrow_exception(exception);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CSnapshot::FindPendingFiles(const CRepoFile& constraints, std::vector<CRepoFile>& files) const
+{
+    if (!mWriter.joinable() || !mWriterStartedEmpty)
+    {
+        return false;
+    }
+    std::string key = StaticGetFilterKey(constraints);
+    if (key.empty())
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mWriterMutex);
+    if (mWriterException)
+    {
+        return false;
+    }
+    for (auto& filter : mWriterFilters)
+    {
+        if (filter.MayContain(key))
+        {
+            return false;
+        }
+    }
+
+    auto range = mWriterPending.equal_range(key);
+    for (auto it = range.first; it != range.second; it++)
+    {
+        if (StaticMatches(*it->second, constraints))
+        {
+            files.push_back(*it->second);
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CSnapshot::StaticMatches(const CRepoFile& file, const CRepoFile& constraints)
+{
+    // the constraints of DBFormatConstraints
+    return (constraints.GetSourcePath().empty() || file.GetSourcePath() == constraints.GetSourcePath())
+        && (!constraints.GetSize().IsSpecified() || file.GetSize() == constraints.GetSize())
+        && (!constraints.GetTime().IsSpecified() || file.GetTime() == constraints.GetTime())
+        && (!constraints.HasHash() || file.GetHash() == constraints.GetHash())
+        && (constraints.GetRelativePath().empty() || file.GetRelativePath() == constraints.GetRelativePath())
+        && (!constraints.GetSourceId().IsSpecified() || file.GetSourceId() == constraints.GetSourceId())
+        && (!constraints.GetSourceChangeTime().IsSpecified() || file.GetSourceChangeTime() == constraints.GetSourceChangeTime());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBOpen(bool writable) const
+{
+    VERIFY(!mSqliteDB.IsOpen());
+
+    CPath path = mPath / DB_FILE_PATH;
+    if (writable)
+    {
+        if (std::filesystem::exists(path))
+        {
+            Helpers::MakeBackup(path);
+            Helpers::MakeWritable(path);
+        }
+        mSqliteDB = CSqliteWrapper(path, false);
+        StaticSetWritePragmas(mSqliteDB);
+    }
+    else
+    {
+        // catalogs of finished snapshots do not change anymore
+        mSqliteDB = CSqliteWrapper(path, true, !IsInProgress());
+        mOpenReadOnlyPosition = sOpenReadOnly.insert(sOpenReadOnly.end(), this);
+    }
+    mIsWritable = writable;
+
+    DBInit();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::StaticSetWritePragmas(CSqliteWrapper& sqliteDB)
+{
+    sqliteDB.RunQuery("pragma locking_mode = exclusive");
+    sqliteDB.RunQuery("pragma cache_size = 1000000");
+    sqliteDB.RunQuery("pragma synchronous = off");
+    sqliteDB.RunQuery("pragma secure_delete = off");
+    sqliteDB.RunQuery("pragma journal_mode = off");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::BuildInMemory(long long memoryLimit)
+{
+    VERIFY(mIsWritable);
+    VERIFY(!mInMemory);
+    VERIFY(!mWriter.joinable());
+
+    // the catalog file keeps the tables created so far, it is overwritten when persisted
+    DBCommit();
+    CSqliteWrapper memoryDB(":memory:", false);
+    mSqliteDB.CopyTo(memoryDB);
+    mSqliteDB.Close();
+    mSqliteDB = std::move(memoryDB);
+    mSqliteDB.RunQuery("pragma journal_mode = off");
+
+    mInMemory       = true;
+    mMemoryLimit    = memoryLimit;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+long long CSnapshot::DBGetSize() const
+{
+    auto pageCountStatement = mSqliteDB.StartQuery("pragma page_count");
+    VERIFY(pageCountStatement.HasData());
+    auto pageSizeStatement = mSqliteDB.StartQuery("pragma page_size");
+    VERIFY(pageSizeStatement.HasData());
+    return pageCountStatement.ReadInt(0) * pageSizeStatement.ReadInt(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBPersist()
+{
+    if (!mInMemory)
+    {
+        return;
+    }
+
+    // pages written while inserting in random order are half empty, vacuum packs them first
+    DBCommit();
+    mSqliteDB.RunQuery("vacuum");
+
+    CSqliteWrapper fileDB(mPath / DB_FILE_PATH, false);
+    StaticSetWritePragmas(fileDB);
+    mSqliteDB.CopyTo(fileDB);
+    mSqliteDB.Close();
+    mSqliteDB = std::move(fileDB);
+
+    mInMemory = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBClose() const
+{
+    if (!mIsWritable)
+    {
+        sOpenReadOnly.erase(mOpenReadOnlyPosition);
+    }
+    mSqliteDB.Close();
+
+    if (mIsWritable)
+    {
+        Helpers::MakeReadOnly(mPath / DB_FILE_PATH);
+        Helpers::MakeBackup(mPath / DB_FILE_PATH);
+        mIsWritable = false;
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-void CSnapshot::CSnapshot::DBDelete(const CRepoFile& constraints)
+void CSnapshot::DBInit() const
 {
-    mSqliteDB.RunQuery("delete from FILES " + DBFormatConstraints(constraints));
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME_FILEDEVICE_FILEINODE, "TODO");
+
+    // an interrupted upgrade keeps the old rows aside and the old format version, its new table is
+    // incomplete. It is dropped, so the upgrade starts over from the old rows
+    if (StaticHasTable(mSqliteDB, "FILES_OLD"))
+    {
+        if (!mIsWritable)
+        {
+            throw "snapshot upgrade was interrupted, run upgrade again: " + mPath.string();
+        }
+        mSqliteDB.RunQuery("drop table if exists FILES");
+    }
+
+    // existing catalogs keep their format, new ones are created with the current one
+    bool isNew = !StaticHasTable(mSqliteDB, "FILES") && !StaticHasTable(mSqliteDB, "FILES_OLD");
+
+    if (isNew)
+    {
+        if (!mIsWritable)
+        {
+            throw "invalid snapshot catalog: " + mPath.string();
+        }
+        mSqliteDB.RunQuery("pragma user_version = " + std::to_string(DB_FORMAT_VERSION));
+    }
+    auto versionStatement = mSqliteDB.StartQuery("pragma user_version");
+    VERIFY(versionStatement.HasData());
+    mFormatVersion = static_cast<int>(versionStatement.ReadInt(0));
+    versionStatement.Finalize();
+    if (mFormatVersion > DB_FORMAT_VERSION)
+    {
+        throw "snapshot format version " + std::to_string(mFormatVersion) + " is not supported: " + mPath.string();
+    }
+
+    if (mIsWritable)
+    {
+        DBCreateTables();
+    }
+
+    // snapshots created before hash algorithms were selectable are sha256, also the ones without META
+    mHashAlgorithm = CHashAlgorithm(CHashAlgorithm::SHA256);
+    if (StaticHasTable(mSqliteDB, "META"))
+    {
+        auto statement = mSqliteDB.StartQuery("select VALUE from META where KEY = 'HASH_ALGORITHM'");
+        if (statement.HasData())
+        {
+            mHashAlgorithm = CHashAlgorithm::StaticFromString(statement.ReadString(0));
+        }
+    }
+    mIsLoaded = true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-bool CSnapshot::CSnapshot::DBCheckIntegrity()
+void CSnapshot::DBCreateTables() const
 {
-    auto statement = mSqliteDB.StartQuery("pragma integrity_check");
-    VERIFY(statement.HasData());
-    return statement.ReadString(0) == "ok";
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME_FILEDEVICE_FILEINODE, "TODO");
+
+    if (mFormatVersion >= 5)
+    {
+        // a file path is unique within a snapshot, so is a row without its hash. Signature lookups
+        // are a single descent of the table, other indices refer to rows by this key
+        mSqliteDB.RunQuery("create table if not exists DIRS (ID integer primary key, PARENT integer not null, NAME text not null)");
+        mSqliteDB.RunQuery(std::string("create table if not exists FILES (SOURCE_DIR integer not null, SOURCE_NAME text not null, SIZE integer not null, TIME integer not null, HASH blob not null, FILE_DIR integer not null, FILE_NAME text not null, SOURCE_DEVICE integer, SOURCE_INODE integer, SOURCE_CTIME integer, ")
+            + (mFormatVersion >= 6 ? "FILE_DEVICE integer, FILE_INODE integer, " : "")
+            + "primary key (SOURCE_DIR, SOURCE_NAME, SIZE, TIME, FILE_DIR, FILE_NAME)) without rowid");
+    }
+    else if (mFormatVersion >= 4)
+    {
+        mSqliteDB.RunQuery("create table if not exists DIRS (ID integer primary key, PARENT integer not null, NAME text not null)");
+        mSqliteDB.RunQuery("create table if not exists FILES (SOURCE_DIR integer not null, SOURCE_NAME text not null, SIZE integer not null, TIME integer not null, HASH blob not null, FILE_DIR integer not null, FILE_NAME text not null, SOURCE_DEVICE integer, SOURCE_INODE integer, SOURCE_CTIME integer)");
+        mSqliteDB.RunQuery("create unique index if not exists FILES_SOURCE_SIZE_TIME_HASH_FILE on FILES (SOURCE_DIR, SOURCE_NAME, SIZE, TIME, HASH, FILE_DIR, FILE_NAME)");
+    }
+    else
+    {
+        mSqliteDB.RunQuery("create table if not exists FILES (SOURCE text not null, SIZE integer not null, TIME integer not null, HASH blob not null, FILE text not null, SOURCE_DEVICE integer, SOURCE_INODE integer, SOURCE_CTIME integer)");
+        mSqliteDB.RunQuery("create unique index if not exists FILES_SOURCE_SIZE_TIME_HASH_FILE on FILES (SOURCE, SIZE, TIME, HASH, FILE)");
+    }
+    mSqliteDB.RunQuery("create index if not exists FILES_HASH on FILES (HASH)");
+    if (mFormatVersion >= 2)
+    {
+        mSqliteDB.RunQuery("create index if not exists FILES_SOURCE_INODE on FILES (SOURCE_INODE)");
+    }
+    mSqliteDB.RunQuery("create table if not exists META (KEY text primary key, VALUE text not null)");
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-void CSnapshot::CSnapshot::DBCompact()
+bool CSnapshot::StaticHasTable(CSqliteWrapper& sqliteDB, const std::string& name)
 {
-    mSqliteDB.RunQuery("vacuum");
+    auto statement = sqliteDB.StartQuery("select count(*) from sqlite_master where type = 'table' and name = ?1");
+    statement.BindString(1, name);
+    VERIFY(statement.HasData());
+    return statement.ReadInt(0) != 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-void CSnapshot::DBInit()
+long long CSnapshot::DBCountFiles() const
 {
-    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE, "TODO");
-
-    mSqliteDB = CSqliteWrapper(mPath / DB_FILE_PATH, false);
-    mSqliteDB.RunQuery("pragma locking_mode = exclusive");
-    mSqliteDB.RunQuery("pragma cache_size = 1000000");
-    mSqliteDB.RunQuery("pragma synchronous = off");
-    mSqliteDB.RunQuery("pragma secure_delete = off");
-    mSqliteDB.RunQuery("pragma journal_mode = off");
-    mSqliteDB.RunQuery("create table if not exists FILES (SOURCE text not null, SIZE integer not null, TIME integer not null, HASH text not null, FILE text not null)");
-    mSqliteDB.RunQuery("create unique index if not exists FILES_SOURCE_SIZE_TIME_HASH_FILE on FILES (SOURCE, SIZE, TIME, HASH, FILE)");
-    mSqliteDB.RunQuery("create index if not exists FILES_HASH on FILES (HASH)");
+    auto statement = DBForReading().StartQuery("select count(*) from FILES");
+    VERIFY(statement.HasData());
+    return statement.ReadInt(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -324,30 +1425,210 @@ CPath CSnapshot::DBStringToPath(const std::string& string)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-std::string CSnapshot::DBFormatConstraints(const CRepoFile& constraints)
+void CSnapshot::DBBindHash(CSqliteWrapper::CStatement& statement, int index, const CHash& hash) const
+{
+    if (mFormatVersion == 0)
+    {
+        statement.BindString(index, hash.ToString());
+    }
+    else
+    {
+        statement.BindBlob(index, hash.GetBytes(), CHash::SIZE);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBBindPath(CSqliteWrapper::CStatement& statement, int directoryIndex, int nameIndex, const CPath& path) const
+{
+    if (mFormatVersion < 4)
+    {
+        statement.BindString(directoryIndex, PathToDBString(path));
+        return;
+    }
+
+    // an unknown directory matches no row
+    statement.BindInt(directoryIndex, DBFindDirectory(path.parent_path()));
+    statement.BindString(nameIndex, PathToDBString(path.filename()));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CSnapshot::DBSelectColumns(const std::string& table) const
+{
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME_FILEDEVICE_FILEINODE, "TODO");
+
+    // columns missing in older catalog versions are read as null. Since version 4 SOURCE and FILE
+    // are names within the directories of columns 8 and 9
+    return std::string("select ")
+        + (mFormatVersion < 4 ? "SOURCE, " : "SOURCE_NAME, ")
+        + "SIZE, TIME, HASH, "
+        + (mFormatVersion < 4 ? "FILE, " : "FILE_NAME, ")
+        + (mFormatVersion < 2 ? "NULL, NULL, " : "SOURCE_DEVICE, SOURCE_INODE, ")
+        + (mFormatVersion < 3 ? "NULL, " : "SOURCE_CTIME, ")
+        + (mFormatVersion < 4 ? "NULL, NULL, " : "SOURCE_DIR, FILE_DIR, ")
+        + (mFormatVersion < 6 ? "NULL, NULL" : "FILE_DEVICE, FILE_INODE")
+        + " from " + table;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBLoadDirectories() const
+{
+    mDirectoryPaths.clear();
+    mDirectoryIds.clear();
+    mDirectoryPaths[0]  = CPath();
+    mDirectoryIds[""]   = 0;
+    mNextDirectoryId    = 1;
+    mDirectoriesLoaded  = true;
+
+    // parents are inserted before their children, i.e., have smaller ids
+    auto statement = DBForReading().StartQuery("select ID, PARENT, NAME from DIRS order by ID");
+    while (statement.HasData())
+    {
+        long long id = statement.ReadInt(0);
+        auto parent = mDirectoryPaths.find(statement.ReadInt(1));
+        if (parent == mDirectoryPaths.end())
+        {
+            throw "invalid directory in snapshot: " + mPath.string();
+        }
+
+        CPath path = parent->second / DBStringToPath(statement.ReadString(2));
+        mDirectoryIds[PathToDBString(path)] = id;
+        mDirectoryPaths[id] = std::move(path);
+        mNextDirectoryId = std::max(mNextDirectoryId, id + 1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+long long CSnapshot::DBFindDirectory(const CPath& path) const
+{
+    VERIFY(mFormatVersion >= 4);
+
+    if (!mDirectoriesLoaded)
+    {
+        DBLoadDirectories();
+    }
+
+    auto it = mDirectoryIds.find(PathToDBString(path));
+    return it == mDirectoryIds.end() ? -1 : it->second;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+long long CSnapshot::DBInsertDirectory(const CPath& path)
+{
+    long long id = DBFindDirectory(path);
+    if (id >= 0)
+    {
+        return id;
+    }
+
+    // a root like "/" or "C:\" is its own parent path, it is stored as a whole
+    bool isRoot = !path.has_relative_path();
+    long long parentId = isRoot ? 0 : DBInsertDirectory(path.parent_path());
+
+    id = mNextDirectoryId++;
+
+    auto statement = DBForWriting().StartCachedQuery("insert into DIRS values (?1, ?2, ?3)");
+    statement.BindInt(1, id);
+    statement.BindInt(2, parentId);
+    statement.BindString(3, PathToDBString(isRoot ? path : CPath(path.filename())));
+    statement.Execute();
+    statement.Finalize();
+
+    mDirectoryIds[PathToDBString(path)] = id;
+    mDirectoryPaths[id] = path;
+
+    return id;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const CPath& CSnapshot::DBGetDirectoryPath(long long id) const
+{
+    if (!mDirectoriesLoaded)
+    {
+        DBLoadDirectories();
+    }
+
+    auto it = mDirectoryPaths.find(id);
+    if (it == mDirectoryPaths.end())
+    {
+        throw "invalid directory in snapshot: " + mPath.string();
+    }
+    return it->second;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBBindFileId(CSqliteWrapper::CStatement& statement, int deviceIndex, int inodeIndex, const CFileId& fileId)
+{
+    if (!fileId.IsSpecified())
+    {
+        statement.BindNull(deviceIndex);
+        statement.BindNull(inodeIndex);
+        return;
+    }
+    statement.BindInt(deviceIndex, static_cast<long long>(fileId.GetDevice()));
+    statement.BindInt(inodeIndex, static_cast<long long>(fileId.GetIndex()));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CSnapshot::DBFormatConstraints(const CRepoFile& constraints) const
 {
-    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE, "TODO");
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME_FILEDEVICE_FILEINODE, "TODO");
 
+    // each column has a fixed parameter number, so the text only depends on which constraints are set
     std::vector<std::string> constraintStrings;
     if (!constraints.GetSourcePath().empty())
     {
-        constraintStrings.push_back("SOURCE=" + CSqliteWrapper::ToStringLiteral(PathToDBString(constraints.GetSourcePath())));
+        if (mFormatVersion < 4)
+        {
+            constraintStrings.push_back("SOURCE=?1");
+        }
+        else
+        {
+            constraintStrings.push_back("SOURCE_DIR=?1");
+            constraintStrings.push_back("SOURCE_NAME=?9");
+        }
     }
     if (constraints.GetSize().IsSpecified())
     {
-        constraintStrings.push_back("SIZE=" + std::to_string(constraints.GetSize()));
+        constraintStrings.push_back("SIZE=?2");
     }
     if (constraints.GetTime().IsSpecified())
     {
-        constraintStrings.push_back("TIME=" + std::to_string(constraints.GetTime()));
+        constraintStrings.push_back("TIME=?3");
     }
     if (constraints.HasHash())
     {
-        constraintStrings.push_back("HASH=" + CSqliteWrapper::ToStringLiteral(constraints.GetHash()));
+        constraintStrings.push_back("HASH=?4");
     }
     if (!constraints.GetRelativePath().empty())
     {
-        constraintStrings.push_back("FILE=" + CSqliteWrapper::ToStringLiteral(PathToDBString(constraints.GetRelativePath())));
+        if (mFormatVersion < 4)
+        {
+            constraintStrings.push_back("FILE=?5");
+        }
+        else
+        {
+            constraintStrings.push_back("FILE_DIR=?5");
+            constraintStrings.push_back("FILE_NAME=?10");
+        }
+    }
+    if (constraints.GetSourceId().IsSpecified())
+    {
+        VERIFY(mFormatVersion >= 2);
+        constraintStrings.push_back("SOURCE_INODE=?7");
+        constraintStrings.push_back("SOURCE_DEVICE=?6");
+    }
+    if (constraints.GetSourceChangeTime().IsSpecified())
+    {
+        VERIFY(mFormatVersion >= 3);
+        constraintStrings.push_back("SOURCE_CTIME=?8");
     }
 
     std::string result;
@@ -366,3 +1647,224 @@ std::string CSnapshot::DBFormatConstraints(const CRepoFile& constraints)
 
     return result;
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::DBBindConstraints(CSqliteWrapper::CStatement& statement, const CRepoFile& constraints) const
+{
+    static_assert(DB_COLUMNS_SOURCE_SIZE_TIME_HASH_FILE_SOURCEDEVICE_SOURCEINODE_SOURCECTIME_FILEDEVICE_FILEINODE, "TODO");
+
+    if (!constraints.GetSourcePath().empty())
+    {
+        DBBindPath(statement, 1, 9, constraints.GetSourcePath());
+    }
+    if (constraints.GetSize().IsSpecified())
+    {
+        statement.BindInt(2, constraints.GetSize());
+    }
+    if (constraints.GetTime().IsSpecified())
+    {
+        statement.BindInt(3, constraints.GetTime());
+    }
+    if (constraints.HasHash())
+    {
+        DBBindHash(statement, 4, constraints.GetHash());
+    }
+    if (!constraints.GetRelativePath().empty())
+    {
+        DBBindPath(statement, 5, 10, constraints.GetRelativePath());
+    }
+    if (constraints.GetSourceId().IsSpecified())
+    {
+        DBBindFileId(statement, 6, 7, constraints.GetSourceId());
+    }
+    if (constraints.GetSourceChangeTime().IsSpecified())
+    {
+        statement.BindInt(8, constraints.GetSourceChangeTime());
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CSnapshot::MayContain(const CRepoFile& constraints) const
+{
+    std::string key = StaticGetFilterKey(constraints);
+    if (key.empty())
+    {
+        return true;
+    }
+
+    if (!mFilterLoaded)
+    {
+        LoadFilter();
+    }
+
+    return !mFilter || mFilter->MayContain(key);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSnapshot::LoadFilter() const
+{
+    mFilterLoaded = true;
+
+    // the catalog of a snapshot in progress is still changing
+    if (IsInProgress())
+    {
+        return;
+    }
+
+    // snapshots finished before filters existed have none until upgraded, their catalog is searched
+    CBloomFilter filter;
+    if (CBloomFilter::StaticLoad(mPath / FILTER_FILE_PATH, filter))
+    {
+        mFilter = std::move(filter);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CBloomFilter CSnapshot::BuildFilter() const
+{
+    CBloomFilter filter(static_cast<size_t>(3 * DBCountFiles()));
+
+    auto iterator = DBSelect({});
+    while (iterator.HasFile())
+    {
+        for (auto& key : StaticGetFilterKeys(iterator.GetNextFile()))
+        {
+            filter.Add(key);
+        }
+    }
+
+    return filter;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::vector<std::string> CSnapshot::StaticGetFilterKeys(const CRepoFile& file)
+{
+    std::vector<std::string> keys;
+    keys.push_back(StaticGetFilterKey({ file.GetSourcePath(), file.GetSize(), file.GetTime(), {}, {}, {} }));
+    keys.push_back(StaticGetFilterKey({ {}, {}, {}, file.GetHash(), {}, {} }));
+    if (file.GetSourceId().IsSpecified())
+    {
+        keys.push_back(StaticGetFilterKey({ {}, file.GetSize(), file.GetTime(), {}, {}, {}, {}, file.GetSourceId() }));
+    }
+    return keys;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string CSnapshot::StaticGetFilterKey(const CRepoFile& constraints)
+{
+    // a search matches only rows matching all constraints, so one key covering a subset suffices.
+    // Returns an empty key if the constraints are not covered by any key
+    auto appendInt = [](std::string& key, long long value)
+    {
+        key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+
+    std::string key;
+    if (!constraints.GetSourcePath().empty() && constraints.GetSize().IsSpecified() && constraints.GetTime().IsSpecified())
+    {
+        key = "S" + PathToDBString(constraints.GetSourcePath());
+        key.push_back('\0');
+        appendInt(key, constraints.GetSize());
+        appendInt(key, constraints.GetTime());
+    }
+    else if (constraints.HasHash())
+    {
+        key = "H";
+        key.append(reinterpret_cast<const char*>(constraints.GetHash().GetBytes()), CHash::SIZE);
+    }
+    else if (constraints.GetSourceId().IsSpecified() && constraints.GetSize().IsSpecified() && constraints.GetTime().IsSpecified())
+    {
+        key = "I";
+        appendInt(key, static_cast<long long>(constraints.GetSourceId().GetDevice()));
+        appendInt(key, static_cast<long long>(constraints.GetSourceId().GetIndex()));
+        appendInt(key, constraints.GetSize());
+        appendInt(key, constraints.GetTime());
+    }
+    return key;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const CManifest* CSnapshot::GetManifest() const
+{
+    if (!mManifestLoaded)
+    {
+        mManifestLoaded = true;
+
+        // the catalog of a snapshot in progress is still changing
+        if (IsInProgress())
+        {
+            return nullptr;
+        }
+
+        long long catalogSize;
+        long long catalogTime;
+        if (!GetCatalogStamp(catalogSize, catalogTime))
+        {
+            return nullptr;
+        }
+        // snapshots finished before manifests existed, or changed by older versions, have none until
+        // upgraded, their catalog is read
+        mManifest.Open(mPath / MANIFEST_FILE_PATH, catalogSize, catalogTime);
+    }
+
+    return mManifest.IsOpen() ? &mManifest : nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CSnapshot::SaveManifest() const
+{
+    VERIFY(!mManifest.IsOpen());
+
+    CManifest::CWriter writer;
+    auto iterator = DBSelect({});
+    while (iterator.HasFile())
+    {
+        writer.Add(iterator.ReadNextFile());
+    }
+
+    long long catalogSize;
+    long long catalogTime;
+    return GetCatalogStamp(catalogSize, catalogTime) && writer.Save(mPath / MANIFEST_FILE_PATH, catalogSize, catalogTime);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CSnapshot::GetCatalogStamp(long long& size, long long& time) const
+{
+    std::error_code errorCode;
+    auto fileSize = std::filesystem::file_size(GetDatabasePath(), errorCode);
+    if (errorCode)
+    {
+        return false;
+    }
+    auto fileTime = std::filesystem::last_write_time(GetDatabasePath(), errorCode);
+    if (errorCode)
+    {
+        return false;
+    }
+
+    size = static_cast<long long>(fileSize);
+    time = static_cast<long long>(fileTime.time_since_epoch().count());
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CSnapshot::StaticIsUnconstrained(const CRepoFile& constraints)
+{
+    return constraints.GetSourcePath().empty()
+        && !constraints.GetSize().IsSpecified()
+        && !constraints.GetTime().IsSpecified()
+        && !constraints.HasHash()
+        && constraints.GetRelativePath().empty()
+        && !constraints.GetSourceId().IsSpecified()
+        && !constraints.GetSourceChangeTime().IsSpecified();
+}
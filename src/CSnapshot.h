@@ -1,9 +1,20 @@
 #pragma once
 
 #include <vector>
+#include <chrono>
+#include <optional>
+#include <list>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <unordered_map>
 
 #include "CSqliteWrapper.h"
 #include "CRepoFile.h"
+#include "CBloomFilter.h"
+#include "CManifest.h"
 
 class CSnapshot
 {
@@ -11,60 +22,267 @@ public: // types
     class CIterator
     {
     public:
-        CIterator(CSqliteWrapper::CStatement&& statement, const CPath& parentPath);
+        CIterator(CSqliteWrapper::CStatement&& statement, const CSnapshot& snapshot);
+
+        // reads the files of a manifest instead, all of them in signature order or the given ones
+        CIterator(const CManifest& manifest, const CSnapshot& snapshot);
+        CIterator(const CManifest& manifest, std::vector<size_t>&& indices, const CSnapshot& snapshot);
 
         bool HasFile();
 
         CRepoFile GetNextFile();
 
+        // reads the next file into storage of the iterator, valid until the next call. Unlike
+        // GetNextFile, no new file is built per row, the buffers of the previous one are reused
+        CRepoFile& ReadNextFile();
+
     private:
-        CPath                       mParentPath;
+        CHash   ReadHash(int col);
+        CFileId ReadFileId(int deviceCol, int indexCol);
+        CPath   ReadPath(int directoryCol, int nameCol);
+        void    ReadPath(int directoryCol, int nameCol, CPath& path);
+
+        const CSnapshot*            mSnapshot;
         CSqliteWrapper::CStatement  mStatement;
+        CRepoFile                   mFile;
+        CPath                       mPath;
+
+        const CManifest*            mManifest   = nullptr;
+        std::vector<size_t>         mIndices;
+        bool                        mIsScan     = false;
+        size_t                      mPosition   = 0;
+    };
+
+    // streams the files in source path order, for merge joins with a traversal in the same order.
+    // Searches in descending order are answered as well, by restarting the stream
+    class CCursor
+    {
+    public:
+        CCursor(const CSnapshot& snapshot);
+
+        const std::vector<CRepoFile>& FindBySource(const CPath& sourcePath);
+
+    private:
+        const std::vector<CRepoFile>& FindBySourceInDirectory(const CPath& sourcePath);
+
+        const CSnapshot*            mSnapshot;
+        std::optional<CIterator>    mIterator;
+        std::optional<CRepoFile>    mNextFile;
+        bool                        mIsExhausted    = true;
+        bool                        mIsStarted      = false;
+        std::string                 mSource;
+        std::vector<CRepoFile>      mFiles;
+
+        // catalogs with a directory table are read one source directory at a time instead
+        CPath                       mDirectory;
+        std::unordered_multimap<std::string, CRepoFile> mDirectoryFiles;
     };
 
 public: // static methods
     static bool StaticIsExsting(const CPath& path);
     static void StaticValidate(const CPath& path);
 
+    // the byte-wise order of these strings is the order of the SOURCE column
+    static std::string PathToDBString(const CPath& path);
+
 public: // methods
     CSnapshot() = default;
-    CSnapshot(CSnapshot&&) = default;
+    CSnapshot(CSnapshot&&) = delete;
     CSnapshot(const CPath& path, bool create);
     ~CSnapshot();
 
     const CPath&    GetAbsolutePath() const;
     CPath           GetMetaDataPath() const;
+    CPath           GetDatabasePath() const;
+
+    // reads the catalog and the filter of a finished snapshot ahead, can run concurrently for
+    // different snapshots but not with other methods of the same snapshot
+    void            Prefetch() const;
 
     void Open(const CPath& path, bool create);
     void Close();
 
+    // the algorithm of all hashes in this snapshot, sha256 for snapshots not recording one
+    CHashAlgorithm  GetHashAlgorithm() const;
+    void            SetHashAlgorithm(CHashAlgorithm hashAlgorithm);
+
     void SetInProgress();
     void ClearInProgress();
-    bool IsInProgress();
+    bool IsInProgress() const;
+
+    // catalogs keep the format they were created with, all formats are read and written
+    int         GetFormatVersion() const;
+
+    // true for catalogs in an older format or of an interrupted upgrade, and for finished snapshots
+    // missing their filter or manifest
+    bool        IsUpgradeNeeded() const;
+
+    // rewrites the catalog of a snapshot in progress in the current format, streaming its rows in
+    // bounded memory. Snapshots of different catalogs can be upgraded concurrently
+    void Upgrade();
+
+    // hands inserts over to a writer thread until the snapshot is finished or closed, so catalog
+    // writes overlap with file I/O. Searches of a snapshot started empty are answered from the rows
+    // not written yet, unless the keys of the written rows allow a match in the catalog. Other
+    // catalog accesses wait for the pending inserts first
+    void StartWriter();
+
+    // builds the catalog of a new snapshot in memory, it is written to its file in one pass when
+    // the snapshot is finished or closed, or as soon as it grows beyond memoryLimit bytes
+    void BuildInMemory(long long memoryLimit);
 
     CRepoFile               FindFile(const CRepoFile& constraints, bool preferLinkable) const;
     std::vector<CRepoFile>  FindAllFiles(const CRepoFile& constraints) const;
 
+    // like FindAllFiles, but the files are read one at a time while iterating, in constant memory.
+    // Finished snapshots are read from their manifest if it can answer the constraints
+    CIterator               IterateFiles(const CRepoFile& constraints) const;
+    std::vector<long long>  FindAllSizes() const;
+
     bool InsertFile(const CPath& source, const CRepoFile& target, bool preferLink);
+    void RegisterFile(const CRepoFile& target);
     bool DeleteFile(CRepoFile& repoFile);
 
     CIterator   DBSelect(const CRepoFile& constraints) const;
+    CIterator   DBSelectFromSource(const CPath& sourcePath) const;
+    CIterator   DBSelectInSourceDirectory(const CPath& directoryPath) const;
     void        DBInsert(const CRepoFile& repoFile);
     void        DBDelete(const CRepoFile& repoFile);
     bool        DBCheckIntegrity();
     void        DBCompact();
 
+    // inserts and deletes are grouped into transactions, committed after a number of rows or a
+    // period of time. Commit makes all pending writes persistent, it is done on close as well
+    void        DBCommit();
+
 private:
-    void DBInit();
+    // catalogs of existing snapshots are opened on first use and read-only, finished ones
+    // immutable. They are reopened for writing, with a backup made, only when changed
+    CSqliteWrapper& DBForReading() const;
+    CSqliteWrapper& DBForWriting();
+    void            DBOpen(bool writable) const;
+    void            DBClose() const;
+
+    void DBInit() const;
+    long long DBGetSize() const;
+    void DBPersist();
+    void DBWriteInsert(const CRepoFile& repoFile);
+
+    // waits until the writer thread is idle, rethrows its first exception
+    void DBFlush() const;
+    void DBStopWriter();
+    void WriterLoop();
+
+    // returns false if the catalog has to be searched, after waiting for the writer
+    bool        FindPendingFiles(const CRepoFile& constraints, std::vector<CRepoFile>& files) const;
+    static bool StaticMatches(const CRepoFile& file, const CRepoFile& constraints);
+    void DBCreateTables() const;
+    void DBLoadDirectories() const;
+    long long DBCountFiles() const;
+    void DBBeginWrite();
+    void DBEndWrite();
 
-    static std::string PathToDBString(const CPath& path);
     static CPath       DBStringToPath(const std::string& path);
-    static std::string DBFormatConstraints(const CRepoFile& constraints);
+    std::string DBFormatConstraints(const CRepoFile& constraints) const;
+    void        DBBindConstraints(CSqliteWrapper::CStatement& statement, const CRepoFile& constraints) const;
+    void        DBBindHash(CSqliteWrapper::CStatement& statement, int index, const CHash& hash) const;
+
+    void        DBBindPath(CSqliteWrapper::CStatement& statement, int directoryIndex, int nameIndex, const CPath& path) const;
+    std::string DBSelectColumns(const std::string& table = "FILES") const;
+
+    // directories of catalogs since version 4 are stored once, rows refer to them by id.
+    // Id 0 is the empty path, FindDirectory returns -1 for unknown directories
+    long long   DBFindDirectory(const CPath& path) const;
+    long long   DBInsertDirectory(const CPath& path);
+    const CPath& DBGetDirectoryPath(long long id) const;
+
+    static void StaticSetWritePragmas(CSqliteWrapper& sqliteDB);
+    static bool StaticHasTable(CSqliteWrapper& sqliteDB, const std::string& name);
+    static void DBBindFileId(CSqliteWrapper::CStatement& statement, int deviceIndex, int inodeIndex, const CFileId& fileId);
+
+    // finished snapshots have a bloom filter over the signature, source id and hash of their files,
+    // built when the snapshot is finished. Searches the filter rules out are skipped
+    bool            MayContain(const CRepoFile& constraints) const;
+    void            LoadFilter() const;
+    CBloomFilter    BuildFilter() const;
+
+    static std::vector<std::string> StaticGetFilterKeys(const CRepoFile& file);
+    static std::string              StaticGetFilterKey(const CRepoFile& constraints);
+
+    // finished snapshots have a manifest, a sorted and memory-mapped copy of their catalog written
+    // when the snapshot is finished. It is valid for one size and time of the catalog
+    const CManifest*    GetManifest() const;
+    bool                SaveManifest() const;
+    bool                GetCatalogStamp(long long& size, long long& time) const;
+
+    static bool         StaticIsUnconstrained(const CRepoFile& constraints);
 
     CPath                       mPath;
     mutable CSqliteWrapper      mSqliteDB;
+    mutable bool                mIsWritable = false;
+    mutable bool                mIsLoaded = false;
+    bool                        mInMemory = false;
+    long long                   mMemoryLimit = 0;
+    mutable CHashAlgorithm      mHashAlgorithm;
+    mutable int                 mFormatVersion = 0;
+
+    // read-only catalogs in order of use, the least recently used ones are closed beyond a limit
+    mutable std::list<const CSnapshot*>::iterator   mOpenReadOnlyPosition;
+    inline static std::list<const CSnapshot*>       sOpenReadOnly;
+
+    mutable std::unordered_map<long long, CPath>        mDirectoryPaths;
+    mutable std::unordered_map<std::string, long long>  mDirectoryIds;
+    mutable bool                                        mDirectoriesLoaded = false;
+    mutable long long                                   mNextDirectoryId = 1;
+
+    bool                                    mInTransaction = false;
+    long long                               mPendingWrites = 0;
+    std::chrono::steady_clock::time_point   mTransactionStart;
+
+    std::thread                             mWriter;
+    mutable std::mutex                      mWriterMutex;
+    std::condition_variable                 mWriterWakeUp;
+    mutable std::condition_variable         mWriterProgress;
+    std::deque<CRepoFile>                   mWriterQueue;
+    bool                                    mWriterBusy     = false;
+    bool                                    mWriterStopping = false;
+    mutable std::exception_ptr              mWriterException;
+    mutable bool                            mWriterFailed   = false;
+
+    // rows queued or being written by filter key, the keys of written rows in filters added as
+    // they fill up. Each row is in one of both, changed under mWriterMutex
+    std::unordered_multimap<std::string, const CRepoFile*>  mWriterPending;
+    std::vector<CBloomFilter>                               mWriterFilters;
+    size_t                                                  mWriterFilterKeys       = 0;
+    size_t                                                  mWriterFilterCapacity   = 0;
+    bool                                                    mWriterStartedEmpty     = false;
+
+    mutable std::optional<CBloomFilter>     mFilter;
+    mutable bool                            mFilterLoaded = false;
+
+    mutable CManifest                       mManifest;
+    mutable bool                            mManifestLoaded = false;
+
+    // version 0 catalogs store hashes as hex text, version 1 as binary blobs,
+    // version 2 adds the device and inode of the source file, version 3 its ctime,
+    // version 4 stores the directories of SOURCE and FILE in the DIRS table,
+    // version 5 clusters FILES on the signature in a table without rowid,
+    // version 6 adds the device and inode of the backup file
+    inline static const int     DB_FORMAT_VERSION       = 6;
+
+    inline static const size_t  DB_MAX_OPEN_READ_ONLY   = 64;
+
+    // page cache of a catalog while upgraded, in KiB
+    inline static const long long   DB_UPGRADE_CACHE_SIZE   = 65536;
+
+    inline static const size_t                      DB_WRITER_QUEUE_SIZE        = 10000;
+    inline static const size_t                      DB_WRITER_FILTER_SIZE       = 65536;
+    inline static const long long                   DB_TRANSACTION_MAX_WRITES   = 10000;
+    inline static const std::chrono::milliseconds   DB_TRANSACTION_MAX_DURATION = std::chrono::milliseconds(2000);
 
     inline static const CPath   META_DATA_PATH          = ".backup";
     inline static const CPath   DB_FILE_PATH            = META_DATA_PATH / "db.sqlite";
     inline static const CPath   IN_PROGRESS_FILE_PATH   = META_DATA_PATH / "IN_PROGRESS";
+    inline static const CPath   FILTER_FILE_PATH        = META_DATA_PATH / "filter.bin";
+    inline static const CPath   MANIFEST_FILE_PATH      = META_DATA_PATH / "manifest.bin";
 };
@@ -12,11 +12,22 @@ CSqliteWrapper::CStatement::CStatement(sqlite3_stmt* statement)
     mStatement(statement)
 {}
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSqliteWrapper::CStatement::CStatement(sqlite3_stmt* statement, CSqliteWrapper* cache, const std::string& query)
+    :
+    mStatement(statement),
+    mCache(cache),
+    mQuery(query)
+{}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 CSqliteWrapper::CStatement::CStatement(CStatement&& other)
 {
-    mStatement = other.mStatement;
+    mStatement  = other.mStatement;
+    mCache      = other.mCache;
+    mQuery      = std::move(other.mQuery);
     other.mStatement = nullptr;
 }
 
@@ -27,6 +38,38 @@ CSqliteWrapper::CStatement::~CStatement()
     Helpers::TryCatch([this]() { Finalize(); });
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSqliteWrapper::CStatement& CSqliteWrapper::CStatement::BindInt(int index, long long value)
+{
+    VERIFY(SQLITE_OK == sqlite3_bind_int64(mStatement, index, value));
+    return *this;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSqliteWrapper::CStatement& CSqliteWrapper::CStatement::BindString(int index, const std::string& value)
+{
+    VERIFY(SQLITE_OK == sqlite3_bind_text(mStatement, index, value.data(), static_cast<int>(value.size()), SQLITE_TRANSIENT));
+    return *this;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSqliteWrapper::CStatement& CSqliteWrapper::CStatement::BindBlob(int index, const void* data, size_t size)
+{
+    VERIFY(SQLITE_OK == sqlite3_bind_blob(mStatement, index, data, static_cast<int>(size), SQLITE_TRANSIENT));
+    return *this;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSqliteWrapper::CStatement& CSqliteWrapper::CStatement::BindNull(int index)
+{
+    VERIFY(SQLITE_OK == sqlite3_bind_null(mStatement, index));
+    return *this;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 bool CSqliteWrapper::CStatement::HasData()
@@ -34,6 +77,13 @@ bool CSqliteWrapper::CStatement::HasData()
     return SQLITE_ROW == sqlite3_step(mStatement);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSqliteWrapper::CStatement::Execute()
+{
+    VERIFY(SQLITE_DONE == sqlite3_step(mStatement));
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 long long CSqliteWrapper::CStatement::ReadInt(int col)
@@ -50,10 +100,51 @@ std::string CSqliteWrapper::CStatement::ReadString(int col)
     return reinterpret_cast<const char*>(sqlite3_column_text(mStatement, col));
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string_view CSqliteWrapper::CStatement::ReadStringView(int col)
+{
+    VERIFY(sqlite3_column_type(mStatement, col) == SQLITE_TEXT);
+    const char* data = reinterpret_cast<const char*>(sqlite3_column_text(mStatement, col));
+    return { data, static_cast<size_t>(sqlite3_column_bytes(mStatement, col)) };
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CSqliteWrapper::CStatement::IsBlob(int col)
+{
+    return sqlite3_column_type(mStatement, col) == SQLITE_BLOB;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CSqliteWrapper::CStatement::IsNull(int col)
+{
+    return sqlite3_column_type(mStatement, col) == SQLITE_NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+const unsigned char* CSqliteWrapper::CStatement::ReadBlob(int col, size_t& size)
+{
+    VERIFY(sqlite3_column_type(mStatement, col) == SQLITE_BLOB);
+    const unsigned char* data = static_cast<const unsigned char*>(sqlite3_column_blob(mStatement, col));
+    size = static_cast<size_t>(sqlite3_column_bytes(mStatement, col));
+    return data;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void CSqliteWrapper::CStatement::Finalize()
 {
+    if (mStatement != nullptr && mCache != nullptr)
+    {
+        // an error of the last step is reported by reset as well, it was handled by the caller already
+        sqlite3_reset(mStatement);
+        VERIFY(SQLITE_OK == sqlite3_clear_bindings(mStatement));
+        mCache->ReturnToCache(mQuery, mStatement);
+        mStatement = nullptr;
+    }
     if (mStatement != nullptr)
     {
         VERIFY(SQLITE_OK == sqlite3_finalize(mStatement));
@@ -77,7 +168,7 @@ CSqliteWrapper::CSqliteWrapper()
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-CSqliteWrapper::CSqliteWrapper(const CPath& path, bool readOnly)
+CSqliteWrapper::CSqliteWrapper(const CPath& path, bool readOnly, bool immutable)
     :
     mSqliteHandle(nullptr)
 {
@@ -90,16 +181,43 @@ CSqliteWrapper::CSqliteWrapper(const CPath& path, bool readOnly)
     {
         flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
     }
-    VERIFY(SQLITE_OK == sqlite3_open_v2(reinterpret_cast<const char*>(path.u8string().c_str()), &mSqliteHandle, flags, nullptr));
+
+    std::string name = reinterpret_cast<const char*>(path.u8string().c_str());
+    if (immutable)
+    {
+        // parameters can only be passed by uri, which needs these characters escaped
+        CPath absolutePath = std::filesystem::absolute(path);
+        std::string uri = absolutePath.has_root_name() ? "file:///" : "file://";
+        for (char c : std::string(reinterpret_cast<const char*>(absolutePath.generic_u8string().c_str())))
+        {
+            if (c == '%' || c == '?' || c == '#')
+            {
+                static const char HEX_DIGITS[] = "0123456789ABCDEF";
+                uri += '%';
+                uri += HEX_DIGITS[static_cast<unsigned char>(c) >> 4];
+                uri += HEX_DIGITS[static_cast<unsigned char>(c) & 0x0F];
+            }
+            else
+            {
+                uri += c;
+            }
+        }
+        name    = uri + "?immutable=1";
+        flags   |= SQLITE_OPEN_URI;
+    }
+
+    VERIFY(SQLITE_OK == sqlite3_open_v2(name.c_str(), &mSqliteHandle, flags, nullptr));
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 CSqliteWrapper::CSqliteWrapper(CSqliteWrapper&& other)
     :
-    mSqliteHandle(other.mSqliteHandle)
+    mSqliteHandle(other.mSqliteHandle),
+    mStatementCache(std::move(other.mStatementCache))
 {
     other.mSqliteHandle = nullptr;
+    other.mStatementCache.clear();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -116,8 +234,10 @@ CSqliteWrapper::~CSqliteWrapper()
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 CSqliteWrapper& CSqliteWrapper::operator = (CSqliteWrapper&& other)
 {
-    mSqliteHandle = other.mSqliteHandle;
+    mSqliteHandle   = other.mSqliteHandle;
+    mStatementCache = std::move(other.mStatementCache);
     other.mSqliteHandle = nullptr;
+    other.mStatementCache.clear();
     return *this;
 }
 
@@ -128,11 +248,31 @@ bool CSqliteWrapper::IsOpen() const
     return mSqliteHandle != nullptr;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool CSqliteWrapper::IsInUse() const
+{
+    VERIFY(mSqliteHandle != nullptr);
+
+    // all prepared statements of the connection, minus the idle ones of the cache
+    size_t statementCount = 0;
+    for (sqlite3_stmt* statement = sqlite3_next_stmt(mSqliteHandle, nullptr); statement != nullptr; statement = sqlite3_next_stmt(mSqliteHandle, statement))
+    {
+        statementCount++;
+    }
+    return statementCount > mStatementCache.size();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void CSqliteWrapper::Close()
 {
     VERIFY(mSqliteHandle != nullptr);
+    for (auto& [query, statement] : mStatementCache)
+    {
+        VERIFY(SQLITE_OK == sqlite3_finalize(statement));
+    }
+    mStatementCache.clear();
     VERIFY(SQLITE_OK == sqlite3_close(mSqliteHandle));
     mSqliteHandle = nullptr;
 }
@@ -145,6 +285,20 @@ void CSqliteWrapper::RunQuery(const std::string& query)
     VERIFY(SQLITE_OK == sqlite3_exec(mSqliteHandle, query.c_str(), nullptr, nullptr, nullptr));
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSqliteWrapper::CopyTo(CSqliteWrapper& target)
+{
+    VERIFY(mSqliteHandle != nullptr);
+    VERIFY(target.mSqliteHandle != nullptr);
+
+    sqlite3_backup* backup = sqlite3_backup_init(target.mSqliteHandle, "main", mSqliteHandle, "main");
+    VERIFY(backup != nullptr);
+    int result = sqlite3_backup_step(backup, -1);
+    sqlite3_backup_finish(backup);
+    VERIFY(result == SQLITE_DONE);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 CSqliteWrapper::CStatement CSqliteWrapper::StartQuery(const std::string& query)
@@ -155,6 +309,36 @@ CSqliteWrapper::CStatement CSqliteWrapper::StartQuery(const std::string& query)
     return statement;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CSqliteWrapper::CStatement CSqliteWrapper::StartCachedQuery(const std::string& query)
+{
+    VERIFY(mSqliteHandle != nullptr);
+
+    // a statement in use is taken out of the cache, nested use of the same query prepares another one
+    auto it = mStatementCache.find(query);
+    if (it != mStatementCache.end())
+    {
+        sqlite3_stmt* statement = it->second;
+        mStatementCache.erase(it);
+        return { statement, this, query };
+    }
+
+    sqlite3_stmt* statement;
+    VERIFY(SQLITE_OK == sqlite3_prepare_v3(mSqliteHandle, query.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &statement, 0));
+    return { statement, this, query };
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CSqliteWrapper::ReturnToCache(const std::string& query, sqlite3_stmt* statement)
+{
+    if (mSqliteHandle == nullptr || !mStatementCache.emplace(query, statement).second)
+    {
+        VERIFY(SQLITE_OK == sqlite3_finalize(statement));
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 std::string CSqliteWrapper::ToStringLiteral(const std::string& input)
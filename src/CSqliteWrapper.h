@@ -1,6 +1,8 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <unordered_map>
 
 #include "CPath.h"
 
@@ -16,33 +18,65 @@ public:
     public:
         CStatement(CStatement&& other);
         CStatement(sqlite3_stmt* statement);
+        CStatement(sqlite3_stmt* statement, CSqliteWrapper* cache, const std::string& query);
         ~CStatement();
 
+        // parameter indices start at 1
+        CStatement& BindInt(int index, long long value);
+        CStatement& BindString(int index, const std::string& value);
+        CStatement& BindBlob(int index, const void* data, size_t size);
+        CStatement& BindNull(int index);
+
         bool        HasData();
+        void        Execute();
 
         long long   ReadInt(int col);
         std::string ReadString(int col);
 
+        // the returned text is valid until the next call to HasData
+        std::string_view ReadStringView(int col);
+        bool        IsBlob(int col);
+        bool        IsNull(int col);
+
+        // the returned data is valid until the next call to HasData
+        const unsigned char* ReadBlob(int col, size_t& size);
+
+        // statements of the cache are reset and handed back instead
         void        Finalize();
 
     private:
-        sqlite3_stmt* mStatement;
+        sqlite3_stmt*   mStatement;
+        CSqliteWrapper* mCache      = nullptr;
+        std::string     mQuery;
     };
 
     CSqliteWrapper();
-    CSqliteWrapper(const CPath& path, bool readOnly);
+    // an immutable database must not be changed by anyone while open, sqlite skips locking then
+    CSqliteWrapper(const CPath& path, bool readOnly, bool immutable = false);
     CSqliteWrapper(CSqliteWrapper&& other);
     ~CSqliteWrapper();
 
     CSqliteWrapper& operator = (CSqliteWrapper&& other);
 
     bool        IsOpen() const;
+
+    // true while any statement not in the cache exists
+    bool        IsInUse() const;
     void        Close();
     void        RunQuery(const std::string& query);
+
+    // replaces the content of target by the one of this database, page by page in one pass
+    void        CopyTo(CSqliteWrapper& target);
     CStatement  StartQuery(const std::string& query);
 
+    // prepares each query text once. The wrapper must not be moved while statements are in use
+    CStatement  StartCachedQuery(const std::string& query);
+
     static std::string ToStringLiteral(const std::string& input);
 
 private:
-    sqlite3* mSqliteHandle;
+    void ReturnToCache(const std::string& query, sqlite3_stmt* statement);
+
+    sqlite3*                                        mSqliteHandle;
+    std::unordered_map<std::string, sqlite3_stmt*>  mStatementCache;
 };
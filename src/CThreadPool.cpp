@@ -0,0 +1,132 @@
+#include "CThreadPool.h"
+
+#include "Helpers.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CThreadPool& CThreadPool::GetInstance()
+{
+    static CThreadPool sSingleton;
+    return sSingleton;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CThreadPool::CThreadPool()
+{
+    // the thread calling Run works as well
+    unsigned int threadCount = std::thread::hardware_concurrency();
+    for (unsigned int i = 1; i < threadCount; i++)
+    {
+        mWorkers.emplace_back([this]() { WorkerLoop(); });
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+CThreadPool::~CThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mWorkAvailable.notify_all();
+
+    for (auto& worker : mWorkers)
+    {
+        worker.join();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+size_t CThreadPool::GetThreadCount() const
+{
+    return mWorkers.size() + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Run(size_t taskCount, const std::function<void(size_t)>& task)
+{
+    if (mWorkers.empty() || taskCount <= 1)
+    {
+        for (size_t i = 0; i < taskCount; i++)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        VERIFY(mTask == nullptr);
+        mTask           = &task;
+        mTaskCount      = taskCount;
+        mNextTask       = 0;
+        mBusyWorkers    = mWorkers.size();
+        mGeneration++;
+    }
+    mWorkAvailable.notify_all();
+
+    RunTasks();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mWorkFinished.wait(lock, [this]() { return mBusyWorkers == 0; });
+    mTask = nullptr;
+
+    if (mException)
+    {
+        std::exception_ptr exception = mException;
+        mException = nullptr;
+        std::rethrow_exception(exception);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CThreadPool::WorkerLoop()
+{
+    unsigned long long lastGeneration = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWorkAvailable.wait(lock, [&]() { return mStopping || mGeneration != lastGeneration; });
+            if (mStopping)
+            {
+                return;
+            }
+            lastGeneration = mGeneration;
+        }
+
+        RunTasks();
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mBusyWorkers--;
+        }
+        mWorkFinished.notify_one();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+void CThreadPool::RunTasks()
+{
+    for (size_t i = mNextTask++; i < mTaskCount; i = mNextTask++)
+    {
+        try
+        {
+            (*mTask)(i);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (!mException)
+            {
+                mException = std::current_exception();
+            }
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+
+class CThreadPool
+{
+public: // methods static
+    static CThreadPool& GetInstance();
+
+public: // methods
+    CThreadPool(const CThreadPool&) = delete;
+    ~CThreadPool();
+
+    // number of threads working on a Run call, including the calling thread
+    size_t GetThreadCount() const;
+
+    // calls task(0) ... task(taskCount - 1) distributed over all threads, returns when all are done.
+    // The first exception thrown by a task is rethrown after the others are done
+    void Run(size_t taskCount, const std::function<void(size_t)>& task);
+
+    CThreadPool& operator = (const CThreadPool&) = delete;
+
+private:
+    CThreadPool();
+
+    void WorkerLoop();
+    void RunTasks();
+
+    std::vector<std::thread>            mWorkers;
+    std::mutex                          mMutex;
+    std::condition_variable             mWorkAvailable;
+    std::condition_variable             mWorkFinished;
+
+    const std::function<void(size_t)>*  mTask           = nullptr;
+    size_t                              mTaskCount      = 0;
+    std::atomic<size_t>                 mNextTask       = 0;
+    unsigned long long                  mGeneration     = 0;
+    size_t                              mBusyWorkers    = 0;
+    bool                                mStopping       = false;
+    std::exception_ptr                  mException;
+};
@@ -2,14 +2,45 @@
 
 #include <iomanip>
 #include <sstream>
+#include <fstream>
+#include <vector>
 #include <algorithm>
 #include <time.h>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#   define HELPERS_X86
+#   ifdef _MSC_VER
+#       include <intrin.h>
+#   else
+#       include <cpuid.h>
+#   endif
+#endif
 
 #include "CLogger.h"
 
 static std::string TIME_FORMAT          = "%Y-%m-%d_%H-%M-%S";
 static std::string TIME_FORMAT_FRIENDLY = "%Y-%m-%d %H:%M:%S";
 
+#ifdef HELPERS_X86
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+static void CpuId(uint32_t leaf, uint32_t registers[4])
+{
+    registers[0] = registers[1] = registers[2] = registers[3] = 0;
+#ifdef _MSC_VER
+    int maxLeaf[4];
+    __cpuid(maxLeaf, 0);
+    if (static_cast<uint32_t>(maxLeaf[0]) >= leaf)
+    {
+        __cpuidex(reinterpret_cast<int*>(registers), static_cast<int>(leaf), 0);
+    }
+#else
+    __get_cpuid_count(leaf, 0, &registers[0], &registers[1], &registers[2], &registers[3]);
+#endif
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 std::string Helpers::NumberAsString(long long number, int minWidth)
@@ -196,6 +227,23 @@ void Helpers::MakeBackup(const CPath& file)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Helpers::ReadAhead(const CPath& file)
+{
+    std::ifstream stream(file, std::ios::binary);
+    if (!stream)
+    {
+        return false;
+    }
+
+    std::vector<char> buffer(1024 * 1024);
+    while (stream.read(buffer.data(), buffer.size()))
+    {
+    }
+    return stream.eof();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 bool Helpers::CreateDirectory(const CPath& dir)
@@ -253,6 +301,58 @@ bool Helpers::IsSuffixOfPath(const CPath& suffix, const CPath& path)
         .first == suffix.native().rend());
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Helpers::CpuSupportsShaNi()
+{
+#ifdef HELPERS_X86
+    uint32_t leaf1[4];
+    uint32_t leaf7[4];
+    CpuId(1, leaf1);
+    CpuId(7, leaf7);
+
+    bool ssse3  = (leaf1[2] & (1u << 9)) != 0;
+    bool sse41  = (leaf1[2] & (1u << 19)) != 0;
+    bool sha    = (leaf7[1] & (1u << 29)) != 0;
+
+    return ssse3 && sse41 && sha;
+#else
+    return false;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+bool Helpers::CpuSupportsAvx2()
+{
+#ifdef HELPERS_X86
+    uint32_t leaf1[4];
+    uint32_t leaf7[4];
+    CpuId(1, leaf1);
+    CpuId(7, leaf7);
+
+    bool osxsave    = (leaf1[2] & (1u << 27)) != 0;
+    bool avx2       = (leaf7[1] & (1u << 5)) != 0;
+    if (!osxsave || !avx2)
+    {
+        return false;
+    }
+
+    // the os has to preserve the ymm registers on context switches
+#ifdef _MSC_VER
+    unsigned long long xcr0 = _xgetbv(0);
+#else
+    uint32_t xcr0Low;
+    uint32_t xcr0High;
+    __asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    unsigned long long xcr0 = xcr0Low;
+#endif
+    return (xcr0 & 0x6) == 0x6;
+#else
+    return false;
+#endif
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void Helpers::TryCatch(std::function<void(void)> function)
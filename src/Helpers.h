@@ -25,12 +25,18 @@ namespace Helpers
     bool MakeWritable(const CPath& file);
     void MakeBackup(const CPath& file);
 
+    // reads a file sequentially into the operating system cache, returns false if it cannot be read
+    bool ReadAhead(const CPath& file);
+
     bool CreateDirectory(const CPath& dir);
     void DeleteEmptyDirectories(const CPath& dir);
 
     bool IsPrefixOfPath(const CPath& prefix, const CPath& path);
     bool IsSuffixOfPath(const CPath& suffix, const CPath& path);
 
+    bool CpuSupportsShaNi();
+    bool CpuSupportsAvx2();
+
     void TryCatch(std::function<void(void)> function);
     bool TryCatchEval(std::function<bool(void)> function);
 };
\ No newline at end of file
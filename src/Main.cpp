@@ -10,6 +10,7 @@
 #include "CCmdPurge.h"
 #include "CCmdDistill.h"
 #include "CCmdClone.h"
+#include "CCmdUpgrade.h"
 
 #ifdef _WIN32
 #   define WIN32_LEAN_AND_MEAN
@@ -28,6 +29,7 @@ std::vector<std::pair<std::string, std::shared_ptr<CCmd>>> CreateCommands()
         { "purge"   , std::make_shared<CCmdPurge>()    },
         { "distill" , std::make_shared<CCmdDistill>()  },
         { "clone"   , std::make_shared<CCmdClone>()    },
+        { "upgrade" , std::make_shared<CCmdUpgrade>()  },
     };
 }
 
@@ -0,0 +1,4 @@
+pushd %~dp0
+..\x64\Release\Backup.exe upgrade --verbose %*
+popd
+pause